@@ -0,0 +1,84 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <span>
+#include "../src/Skiplist.hpp"
+
+// compare the single thread read throughput of the sequential read loop
+// with read_batch and the coroutine lookups of read_batch_coroutines,
+// on lists of 1M, 10M and 100M keys, or the key counts given as arguments
+
+#define READ_TEST_COUNT 1000000
+#define READ_BATCH_SIZE 64
+
+void report(const std::string& mode, double secs) {
+    std::cout << mode << " complete." << std::endl;
+    std::cout << "use " << secs << " secs for " << READ_TEST_COUNT << " keys" << std::endl;
+    std::cout << "QPS: " << (READ_TEST_COUNT / secs) << std::endl;
+}
+
+void testRead(long key_count) {
+    std::cout << std::endl;
+    std::cout << "[TEST INFO]" << std::endl;
+    std::cout << "Test Batch Read Performance of the lookup modes:" << std::endl;
+    std::cout << "Key Type : int, Value Type: int" << std::endl;
+    std::cout << "The number of keys in the list: " << key_count << std::endl;
+    std::cout << "Key is random generated in [0, " << 2 * key_count << "), half of them exist" << std::endl;
+    std::cout << "The number of keys per batch: " << READ_BATCH_SIZE << std::endl;
+    std::cout << "The number of read keys: " << READ_TEST_COUNT << std::endl;
+
+    Skiplist<int, int> list;
+    for (long i = 0; i < key_count; i++) {
+        list.insert(int(2 * i), int(i));
+    }
+    std::vector<int> keys(READ_TEST_COUNT);
+    unsigned int seed = 1;
+    for (int i = 0; i < READ_TEST_COUNT; i++) {
+        keys[i] = int(((long)rand_r(&seed) * RAND_MAX + rand_r(&seed)) % (2 * key_count));
+    }
+    std::vector<int> values(READ_TEST_COUNT);
+    std::unique_ptr<bool[]> found(new bool[READ_TEST_COUNT]);
+    std::vector<std::optional<int>> optional_values(READ_TEST_COUNT);
+
+    std::cout << "[TEST BEGIN]" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < READ_TEST_COUNT; i++) {
+        list.read(keys[i], values[i]);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    report("read one by one", elapsed.count());
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < READ_TEST_COUNT; i += READ_BATCH_SIZE) {
+        int n = std::min(READ_BATCH_SIZE, READ_TEST_COUNT - i);
+        list.read_batch(&keys[i], n, &values[i], &found[i]);
+    }
+    elapsed = std::chrono::high_resolution_clock::now() - start;
+    report("read_batch", elapsed.count());
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < READ_TEST_COUNT; i += READ_BATCH_SIZE) {
+        int n = std::min(READ_BATCH_SIZE, READ_TEST_COUNT - i);
+        list.read_batch_coroutines(std::span<const int>(&keys[i], n),
+                                   std::span<std::optional<int>>(&optional_values[i], n));
+    }
+    elapsed = std::chrono::high_resolution_clock::now() - start;
+    report("read_batch_coroutines", elapsed.count());
+}
+
+int main(int argc, char** argv) {
+    std::vector<long> key_counts = {1000000, 10000000, 100000000};
+    if (argc > 1) {
+        key_counts.clear();
+        for (int i = 1; i < argc; i++) {
+            key_counts.push_back(atol(argv[i]));
+        }
+    }
+    for (long key_count : key_counts) {
+        testRead(key_count);
+    }
+    return 0;
+}
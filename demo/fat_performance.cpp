@@ -0,0 +1,63 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include "../src/Skiplist.hpp"
+#include "../src/FatSkiplist.hpp"
+
+// compare the single thread insert and read QPS of Skiplist
+// with the one of FatSkiplist, whose nodes hold blocks of keys
+
+#define KEY_COUNT 1000000
+#define READ_TEST_COUNT 1000000
+
+template<class List>
+void testList(const std::string& name, List& list) {
+    std::cout << std::endl;
+    std::cout << "[TEST INFO]" << std::endl;
+    std::cout << "Test Insert and Read Performance of: " << name << std::endl;
+    std::cout << "Key Type : int, Value Type: int" << std::endl;
+    std::cout << "Key is random generated in [0, " << 2 * KEY_COUNT << ")" << std::endl;
+    std::cout << "The number of insert operation: " << KEY_COUNT << std::endl;
+    std::cout << "The number of read operation: " << READ_TEST_COUNT << std::endl;
+
+    std::vector<int> keys(KEY_COUNT);
+    unsigned int seed = 1;
+    for (int i = 0; i < KEY_COUNT; i++) {
+        keys[i] = rand_r(&seed) % (2 * KEY_COUNT);
+    }
+
+    std::cout << "[TEST BEGIN]" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < KEY_COUNT; i++) {
+        list.insert(keys[i], i);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "insert complete." << std::endl;
+    std::cout << "use " << elapsed.count() << " secs for " << KEY_COUNT << " insert operation" << std::endl;
+    std::cout << "QPS: " << (KEY_COUNT / elapsed.count()) << std::endl;
+
+    start = std::chrono::high_resolution_clock::now();
+    long found = 0;
+    for (int i = 0; i < READ_TEST_COUNT; i++) {
+        int value;
+        found += list.read(rand_r(&seed) % (2 * KEY_COUNT), value);
+    }
+    elapsed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "read complete, " << found << " keys found." << std::endl;
+    std::cout << "use " << elapsed.count() << " secs for " << READ_TEST_COUNT << " read operation" << std::endl;
+    std::cout << "QPS: " << (READ_TEST_COUNT / elapsed.count()) << std::endl;
+}
+
+int main() {
+    {
+        Skiplist<int, int> list;
+        testList("Skiplist", list);
+    }
+    {
+        FatSkiplist<int, int> list;
+        testList("FatSkiplist, 16 keys per node", list);
+        std::cout << "nodes: " << list.node_count() << std::endl;
+    }
+    return 0;
+}
@@ -29,7 +29,8 @@ public:
         return _list.read(key, value);
     }
 private:
-    Skiplist<int, std::string> _list;
+    // long running with a steady erase rate, erased nodes must be freed
+    Skiplist<int, std::string, EpochReclamation> _list;
 };
 
 Server global_s;
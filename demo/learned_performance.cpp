@@ -0,0 +1,67 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include "../src/Skiplist.hpp"
+
+// compare where the point lookups of integer keys start: at the head,
+// at the entry table or at the node the learned entry layer predicts,
+// on mostly appended, smoothly distributed keys like timestamps
+
+#define KEY_COUNT 1000000
+#define READ_TEST_COUNT 1000000
+// the keys are about this far apart
+#define KEY_STEP 1000
+
+typedef Skiplist<long long, int> List;
+
+void testLayer(const std::string& name, List::EntryLayer layer, const std::vector<long long>& keys) {
+    std::cout << std::endl;
+    std::cout << "[TEST INFO]" << std::endl;
+    std::cout << "Test Insert and Read Performance of lookups starting " << name << std::endl;
+    std::cout << "Key Type : long long, Value Type: int" << std::endl;
+    std::cout << "Key is i * " << KEY_STEP << " plus a random jitter in [0, " << KEY_STEP
+              << "), 1/16 of them inserted out of order" << std::endl;
+    std::cout << "The number of insert operation: " << KEY_COUNT << std::endl;
+    std::cout << "The number of read operation: " << READ_TEST_COUNT << std::endl;
+
+    List list(nullptr);
+    list.set_entry_layer(layer);
+    std::cout << "[TEST BEGIN]" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < KEY_COUNT; i++) {
+        list.insert(keys[i], i);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "insert complete." << std::endl;
+    std::cout << "use " << elapsed.count() << " secs for " << KEY_COUNT << " insert operation" << std::endl;
+    std::cout << "QPS: " << (KEY_COUNT / elapsed.count()) << std::endl;
+
+    unsigned int seed = 2;
+    start = std::chrono::high_resolution_clock::now();
+    long found = 0;
+    for (int i = 0; i < READ_TEST_COUNT; i++) {
+        int value;
+        found += list.read(keys[rand_r(&seed) % KEY_COUNT], value);
+    }
+    elapsed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "read complete, " << found << " keys found." << std::endl;
+    std::cout << "use " << elapsed.count() << " secs for " << READ_TEST_COUNT << " read operation" << std::endl;
+    std::cout << "QPS: " << (READ_TEST_COUNT / elapsed.count()) << std::endl;
+}
+
+int main() {
+    std::vector<long long> keys(KEY_COUNT);
+    unsigned int seed = 1;
+    for (int i = 0; i < KEY_COUNT; i++) {
+        keys[i] = 1650000000000LL + (long long)i * KEY_STEP + rand_r(&seed) % KEY_STEP;
+    }
+    // some keys arrive late
+    for (int i = 0; i < KEY_COUNT; i += 16) {
+        std::swap(keys[i], keys[rand_r(&seed) % KEY_COUNT]);
+    }
+    testLayer("at the head", List::NO_ENTRY_LAYER, keys);
+    testLayer("at the entry table", List::ENTRY_TABLE_LAYER, keys);
+    testLayer("at the learned entry layer", List::LEARNED_LAYER, keys);
+    return 0;
+}
@@ -4,16 +4,51 @@
 #include <pthread.h>
 #include <time.h>
 #include <signal.h>
+#include <atomic>
+#include <new>
+#include <memory>
+#include <vector>
 #include "../thirdparty/googletest/include/gtest/gtest.h"
 #include "../src/Skiplist.hpp"
 
 #define WRITE_TEST_COUNT 1000000
+#define WRITE_NUM_THREADS 4
+
+#define ERASE_KEY_COUNT 10000000
+#define ERASE_TEST_COUNT 1000000
 
 #define READ_NUM_THREADS 100
 #define READ_TEST_COUNT 1000000
 
+#define READ_BATCH_SIZE 64
+// the range of keys a batch of the range heavy batch read test falls into
+#define READ_BATCH_RANGE 512
+
+#define BULK_LOAD_COUNT 10000000
+
+#define INSERT_BATCH_KEY_COUNT 1000000
+#define INSERT_BATCH_TEST_COUNT 1000000
+
+// count the heap allocations, an insert should only allocate its node
+std::atomic<long> allocations(0);
+void* operator new(size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(n ? n : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void* p) noexcept {
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
 BasicSerializer serializer;
 Skiplist<int, std::string> skipList(&serializer);
+Skiplist<int, std::string> multiWriteList(&serializer);
 
 void *insertElementRand(void* threadid) {
     for (int i = 0; i < WRITE_TEST_COUNT; i++) {
@@ -29,6 +64,24 @@ void *insertElementOrder(void* threadid) {
     pthread_exit(NULL);
 }
 
+void *insertElementRandMulti(void* threadid) {
+    unsigned int seed = (unsigned int)(long)threadid;
+    for (int i = 0; i < WRITE_TEST_COUNT / WRITE_NUM_THREADS; i++) {
+        multiWriteList.insert(rand_r(&seed), "testStr");
+    }
+    pthread_exit(NULL);
+}
+
+Skiplist<int, int> eraseList;
+
+void *eraseElementRand(void* threadid) {
+    unsigned int seed = 1;
+    for (int i = 0; i < ERASE_TEST_COUNT; i++) {
+        eraseList.erase(rand_r(&seed) % ERASE_KEY_COUNT);
+    }
+    pthread_exit(NULL);
+}
+
 void *readElement(void* threadid) {
     for (int i = 0; i < READ_TEST_COUNT; i++) {
         std::string str;
@@ -50,6 +103,7 @@ int main() {
         pthread_t w_thread;
         std::cout << "[TEST BEGIN]" << std::endl;
         std::cout << "creating thread for insert..." << std::endl;
+        long allocs = allocations.load();
         auto start = std::chrono::high_resolution_clock::now();
         int rc = pthread_create(&w_thread, NULL, insertElementOrder, NULL);
         if (rc) {
@@ -68,6 +122,7 @@ int main() {
         std::chrono::duration<double> elapsed = finish - start;
         std::cout << "use " << elapsed.count() << " secs for " << WRITE_TEST_COUNT << " insert operation" << std::endl;
         std::cout << "QPS: " << (WRITE_TEST_COUNT / elapsed.count()) << std::endl;
+        std::cout << "heap allocations per insert: " << (double)(allocations.load() - allocs) / WRITE_TEST_COUNT << std::endl;
     }
 
     {
@@ -81,6 +136,7 @@ int main() {
         pthread_t w_thread;
         std::cout << "[TEST BEGIN]" << std::endl;
         std::cout << "creating thread for insert..." << std::endl;
+        long allocs = allocations.load();
         auto start = std::chrono::high_resolution_clock::now();
         int rc = pthread_create(&w_thread, NULL, insertElementRand, NULL);
         if (rc) {
@@ -99,6 +155,7 @@ int main() {
         std::cout << "insert complete." << std::endl;
         std::cout << "use " << elapsed.count() << " secs for " << WRITE_TEST_COUNT << " insert operation" << std::endl;
         std::cout << "QPS: " << (WRITE_TEST_COUNT / elapsed.count()) << std::endl;
+        std::cout << "heap allocations per insert: " << (double)(allocations.load() - allocs) / WRITE_TEST_COUNT << std::endl;
 
         // Test Read Performance for single-thread
         std::cout << std::endl;
@@ -167,5 +224,234 @@ int main() {
         std::cout << "QPS: " << (READ_TEST_COUNT / elapsed.count()) << std::endl;
     }
 
+    {
+        std::cout << std::endl;
+        std::cout << "[TEST INFO]" << std::endl;
+        std::cout << "Test Insert Performance for multi-threads:" << std::endl;
+        std::cout << "Key Type : int, Value Type: std::string" << std::endl;
+        std::cout << "Key is random generated, Value is fixed." << std::endl;
+        std::cout << "The number of write threads: " << WRITE_NUM_THREADS << std::endl;
+        std::cout << "The number of insert operation: " << WRITE_TEST_COUNT << std::endl;
+
+        pthread_t w_threads[WRITE_NUM_THREADS];
+        std::cout << "[TEST BEGIN]" << std::endl;
+        std::cout << "creating threads for insert..." << std::endl;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(long i = 0; i < WRITE_NUM_THREADS; i++ ) {
+            int rc = pthread_create(&w_threads[i], NULL, insertElementRandMulti, (void*)(i + 1));
+            if (rc) {
+                std::cout << "Error:unable to create thread," << rc << std::endl;
+                exit(-1);
+            }
+        }
+
+        void *ret;
+        for(int i = 0; i < WRITE_NUM_THREADS; i++ ) {
+            if (pthread_join(w_threads[i], &ret) !=0 )  {
+                perror("join error");
+                exit(-1);
+            }
+        }
+
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = finish - start;
+        std::cout << "insert complete." << std::endl;
+        std::cout << WRITE_NUM_THREADS << " threads ";
+        std::cout << "use " << elapsed.count() << " secs for " << WRITE_TEST_COUNT << " insert operation" << std::endl;
+        std::cout << "QPS: " << (WRITE_TEST_COUNT / elapsed.count()) << std::endl;
+    }
+
+    {
+        std::cout << std::endl;
+        std::cout << "[TEST INFO]" << std::endl;
+        std::cout << "Test Erase Performance:" << std::endl;
+        std::cout << "Key Type : int, Value Type: int" << std::endl;
+        std::cout << "The number of keys in the list: " << ERASE_KEY_COUNT << std::endl;
+        std::cout << "Key is random generated in [0, " << ERASE_KEY_COUNT << ")" << std::endl;
+        std::cout << "The number of erase operation: " << ERASE_TEST_COUNT << std::endl;
+
+        for (int i = 0; i < ERASE_KEY_COUNT; i++) {
+            eraseList.insert(i, i);
+        }
+
+        pthread_t e_thread;
+        std::cout << "[TEST BEGIN]" << std::endl;
+        std::cout << "creating thread for erase..." << std::endl;
+        auto start = std::chrono::high_resolution_clock::now();
+        int rc = pthread_create(&e_thread, NULL, eraseElementRand, NULL);
+        if (rc) {
+            std::cout << "Error:unable to create thread," << rc << std::endl;
+            exit(-1);
+        }
+
+        void *ret;
+        if (pthread_join(e_thread, &ret) !=0 )  {
+            perror("join error");
+            exit(-1);
+        }
+
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = finish - start;
+        std::cout << "erase complete." << std::endl;
+        std::cout << "use " << elapsed.count() << " secs for " << ERASE_TEST_COUNT << " erase operation" << std::endl;
+        std::cout << "QPS: " << (ERASE_TEST_COUNT / elapsed.count()) << std::endl;
+    }
+
+    {
+        std::cout << std::endl;
+        std::cout << "[TEST INFO]" << std::endl;
+        std::cout << "Test Batch Read Performance:" << std::endl;
+        std::cout << "Key Type : int, Value Type: int" << std::endl;
+        std::cout << "The list is the one of the erase test" << std::endl;
+        std::cout << "Key is random generated in [0, " << ERASE_KEY_COUNT << ")" << std::endl;
+        std::cout << "The number of keys per read_batch: " << READ_BATCH_SIZE << std::endl;
+        std::cout << "The number of read keys: " << READ_TEST_COUNT << std::endl;
+
+        std::vector<int> keys(READ_TEST_COUNT);
+        unsigned int seed = 2;
+        for (int i = 0; i < READ_TEST_COUNT; i++) {
+            keys[i] = rand_r(&seed) % ERASE_KEY_COUNT;
+        }
+        std::vector<int> values(READ_TEST_COUNT);
+        std::unique_ptr<bool[]> found(new bool[READ_TEST_COUNT]);
+
+        std::cout << "[TEST BEGIN]" << std::endl;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < READ_TEST_COUNT; i++) {
+            eraseList.read(keys[i], values[i]);
+        }
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = finish - start;
+        std::cout << "read one by one complete." << std::endl;
+        std::cout << "use " << elapsed.count() << " secs for " << READ_TEST_COUNT << " keys" << std::endl;
+        std::cout << "QPS: " << (READ_TEST_COUNT / elapsed.count()) << std::endl;
+
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < READ_TEST_COUNT; i += READ_BATCH_SIZE) {
+            int n = std::min(READ_BATCH_SIZE, READ_TEST_COUNT - i);
+            eraseList.read_batch(&keys[i], n, &values[i], &found[i]);
+        }
+        finish = std::chrono::high_resolution_clock::now();
+        elapsed = finish - start;
+        std::cout << "read_batch complete." << std::endl;
+        std::cout << "use " << elapsed.count() << " secs for " << READ_TEST_COUNT << " keys" << std::endl;
+        std::cout << "QPS: " << (READ_TEST_COUNT / elapsed.count()) << std::endl;
+
+        // the keys of each batch fall into a random range of READ_BATCH_RANGE keys
+        for (int i = 0; i < READ_TEST_COUNT; i += READ_BATCH_SIZE) {
+            int base = rand_r(&seed) % (ERASE_KEY_COUNT - READ_BATCH_RANGE);
+            for (int j = i; j < std::min(i + READ_BATCH_SIZE, READ_TEST_COUNT); j++) {
+                keys[j] = base + rand_r(&seed) % READ_BATCH_RANGE;
+            }
+        }
+        std::cout << "Key of a batch is random generated in a random range of " << READ_BATCH_RANGE << " keys" << std::endl;
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < READ_TEST_COUNT; i++) {
+            eraseList.read(keys[i], values[i]);
+        }
+        finish = std::chrono::high_resolution_clock::now();
+        elapsed = finish - start;
+        std::cout << "read one by one complete." << std::endl;
+        std::cout << "use " << elapsed.count() << " secs for " << READ_TEST_COUNT << " keys" << std::endl;
+        std::cout << "QPS: " << (READ_TEST_COUNT / elapsed.count()) << std::endl;
+
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < READ_TEST_COUNT; i += READ_BATCH_SIZE) {
+            int n = std::min(READ_BATCH_SIZE, READ_TEST_COUNT - i);
+            eraseList.read_batch(&keys[i], n, &values[i], &found[i]);
+        }
+        finish = std::chrono::high_resolution_clock::now();
+        elapsed = finish - start;
+        std::cout << "read_batch complete." << std::endl;
+        std::cout << "use " << elapsed.count() << " secs for " << READ_TEST_COUNT << " keys" << std::endl;
+        std::cout << "QPS: " << (READ_TEST_COUNT / elapsed.count()) << std::endl;
+    }
+
+    {
+        std::cout << std::endl;
+        std::cout << "[TEST INFO]" << std::endl;
+        std::cout << "Test Bulk Load Performance:" << std::endl;
+        std::cout << "Key Type : int, Value Type: int" << std::endl;
+        std::cout << "Key is in [0, " << BULK_LOAD_COUNT << ") in ascending order, as in a dump" << std::endl;
+        std::cout << "The number of pairs: " << BULK_LOAD_COUNT << std::endl;
+
+        std::vector<std::pair<int, int>> pairs;
+        pairs.reserve(BULK_LOAD_COUNT);
+        for (int i = 0; i < BULK_LOAD_COUNT; i++) {
+            pairs.emplace_back(i, i);
+        }
+
+        std::cout << "[TEST BEGIN]" << std::endl;
+        {
+            Skiplist<int, int> list;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (auto& pair : pairs) {
+                list.insert(pair.first, pair.second);
+            }
+            auto finish = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> elapsed = finish - start;
+            std::cout << "insert one by one complete." << std::endl;
+            std::cout << "use " << elapsed.count() << " secs for " << BULK_LOAD_COUNT << " pairs" << std::endl;
+            std::cout << "QPS: " << (BULK_LOAD_COUNT / elapsed.count()) << std::endl;
+        }
+        {
+            Skiplist<int, int> list;
+            auto start = std::chrono::high_resolution_clock::now();
+            list.bulk_load(pairs.begin(), pairs.end());
+            auto finish = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> elapsed = finish - start;
+            std::cout << "bulk_load complete." << std::endl;
+            std::cout << "use " << elapsed.count() << " secs for " << BULK_LOAD_COUNT << " pairs" << std::endl;
+            std::cout << "QPS: " << (BULK_LOAD_COUNT / elapsed.count()) << std::endl;
+        }
+    }
+
+    {
+        std::cout << std::endl;
+        std::cout << "[TEST INFO]" << std::endl;
+        std::cout << "Test Batch Insert Performance:" << std::endl;
+        std::cout << "Key Type : int, Value Type: int" << std::endl;
+        std::cout << "The number of keys in the list: " << INSERT_BATCH_KEY_COUNT << std::endl;
+        std::cout << "Key is random generated" << std::endl;
+        std::cout << "The number of insert operation: " << INSERT_BATCH_TEST_COUNT << std::endl;
+
+        unsigned int seed = 3;
+        std::vector<std::pair<int, int>> initial;
+        for (int i = 0; i < INSERT_BATCH_KEY_COUNT; i++) {
+            initial.emplace_back(rand_r(&seed), i);
+        }
+        std::sort(initial.begin(), initial.end());
+        std::vector<std::pair<int, int>> pairs;
+        for (int i = 0; i < INSERT_BATCH_TEST_COUNT; i++) {
+            pairs.emplace_back(rand_r(&seed), i);
+        }
+
+        std::cout << "[TEST BEGIN]" << std::endl;
+        // batch size 0 inserts the pairs one by one
+        for (int batch_size : {0, 1, 16, 256, 4096}) {
+            Skiplist<int, int> list;
+            list.bulk_load(initial.begin(), initial.end());
+            auto start = std::chrono::high_resolution_clock::now();
+            if (batch_size == 0) {
+                for (auto& pair : pairs) {
+                    list.insert(pair.first, pair.second);
+                }
+            } else {
+                for (int i = 0; i < INSERT_BATCH_TEST_COUNT; i += batch_size) {
+                    list.insert_batch(&pairs[i], std::min(batch_size, INSERT_BATCH_TEST_COUNT - i));
+                }
+            }
+            auto finish = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> elapsed = finish - start;
+            if (batch_size == 0) {
+                std::cout << "insert one by one complete." << std::endl;
+            } else {
+                std::cout << "insert_batch of " << batch_size << " pairs complete." << std::endl;
+            }
+            std::cout << "use " << elapsed.count() << " secs for " << INSERT_BATCH_TEST_COUNT << " insert operation" << std::endl;
+            std::cout << "QPS: " << (INSERT_BATCH_TEST_COUNT / elapsed.count()) << std::endl;
+        }
+    }
+
     return 0;
 }
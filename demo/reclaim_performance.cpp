@@ -0,0 +1,131 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <atomic>
+#include <pthread.h>
+#include <time.h>
+#include "../src/Skiplist.hpp"
+
+// compare the read QPS of the reclamation modes,
+// once on a static list and once while a writer churns through it
+
+#define KEY_COUNT 1000000
+
+#define READ_NUM_THREADS 4
+#define READ_TEST_COUNT 1000000
+
+template<class List>
+struct ReadArgs {
+    List* list;
+    unsigned int seed;
+};
+
+template<class List>
+void *readElement(void* p) {
+    ReadArgs<List>* args = (ReadArgs<List>*)p;
+    for (int i = 0; i < READ_TEST_COUNT; i++) {
+        std::string str;
+        args->list->read(rand_r(&args->seed) % KEY_COUNT, str);
+    }
+    pthread_exit(NULL);
+}
+
+template<class List>
+struct WriteArgs {
+    List* list;
+    std::atomic<bool>* stop;
+};
+
+// erase 30% of the time, like the writer of kv_service
+template<class List>
+void *churnElement(void* p) {
+    WriteArgs<List>* args = (WriteArgs<List>*)p;
+    unsigned int seed = 1;
+    while (!args->stop->load()) {
+        int key = rand_r(&seed) % KEY_COUNT;
+        if (rand_r(&seed) % 10 < 3) {
+            args->list->erase(key);
+        } else {
+            args->list->insert(key, "testStr");
+        }
+    }
+    pthread_exit(NULL);
+}
+
+template<class List>
+void testRead(const std::string& mode, List& list, bool churn) {
+    std::cout << std::endl;
+    std::cout << "[TEST INFO]" << std::endl;
+    std::cout << "Test Read Performance of reclamation mode: " << mode << std::endl;
+    std::cout << "Key Type : int, Value Type: std::string" << std::endl;
+    std::cout << "Key is random generated in [0, " << KEY_COUNT << ")" << std::endl;
+    std::cout << "Concurrent writer: " << (churn ? "insert/erase" : "none") << std::endl;
+    std::cout << "The number of read threads: " << READ_NUM_THREADS << std::endl;
+    std::cout << "The number of read operation for each thread: " << READ_TEST_COUNT << std::endl;
+
+    std::atomic<bool> stop(false);
+    WriteArgs<List> w_args = {&list, &stop};
+    pthread_t w_thread;
+    if (churn) {
+        int rc = pthread_create(&w_thread, NULL, churnElement<List>, &w_args);
+        if (rc) {
+            std::cout << "Error:unable to create thread," << rc << std::endl;
+            exit(-1);
+        }
+    }
+
+    pthread_t r_threads[READ_NUM_THREADS];
+    ReadArgs<List> r_args[READ_NUM_THREADS];
+    std::cout << "[TEST BEGIN]" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < READ_NUM_THREADS; i++) {
+        r_args[i].list = &list;
+        r_args[i].seed = i + 1;
+        int rc = pthread_create(&r_threads[i], NULL, readElement<List>, &r_args[i]);
+        if (rc) {
+            std::cout << "Error:unable to create thread," << rc << std::endl;
+            exit(-1);
+        }
+    }
+
+    void *ret;
+    for (int i = 0; i < READ_NUM_THREADS; i++) {
+        if (pthread_join(r_threads[i], &ret) != 0) {
+            perror("join error");
+            exit(-1);
+        }
+    }
+    auto finish = std::chrono::high_resolution_clock::now();
+
+    if (churn) {
+        stop.store(true);
+        if (pthread_join(w_thread, &ret) != 0) {
+            perror("join error");
+            exit(-1);
+        }
+    }
+
+    std::chrono::duration<double> elapsed = finish - start;
+    std::cout << "read complete." << std::endl;
+    std::cout << READ_NUM_THREADS << " threads ";
+    std::cout << "use " << elapsed.count() << " secs for " << READ_TEST_COUNT << " read operation respectively" << std::endl;
+    std::cout << "QPS: " << (READ_NUM_THREADS * READ_TEST_COUNT / elapsed.count()) << std::endl;
+}
+
+template<class Reclaimer>
+void testMode(const std::string& mode) {
+    Skiplist<int, std::string, Reclaimer> list;
+    for (int i = 0; i < KEY_COUNT; i++) {
+        list.insert(rand() % KEY_COUNT, "testStr");
+    }
+    testRead(mode, list, false);
+    testRead(mode, list, true);
+}
+
+int main() {
+    srand(time(NULL));
+    testMode<NoReclamation>("NoReclamation");
+    testMode<EpochReclamation>("EpochReclamation");
+    testMode<HazardPointerReclamation>("HazardPointerReclamation");
+    return 0;
+}
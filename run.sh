@@ -1,5 +1,5 @@
 rm -rf ./build ./output
 mkdir output &&mkdir build && cd build
 cmake .. && make
-mv ./unit_test ./../output && mv ./performance_test ./../output && mv ./kv_service ./../output
+mv ./unit_test ./../output && mv ./performance_test ./../output && mv ./kv_service ./../output && mv ./reclaim_performance_test ./../output && mv ./coroutine_performance_test ./../output && mv ./fat_performance_test ./../output && mv ./learned_performance_test ./../output
 rm -rf ../build
\ No newline at end of file
@@ -0,0 +1,142 @@
+//
+// Created by chenfeiwang on 4/20/22.
+//
+
+#ifndef SKIPLIST_CHENFEI_ARENA_HPP
+#define SKIPLIST_CHENFEI_ARENA_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cassert>
+#include <new>
+
+// cache line size assumed for the layout of arena allocations
+#define CACHE_LINE_SIZE 64
+
+// A bump allocator, memory is handed out of large blocks
+// and only released in bulk when the arena is destroyed.
+// allocate is lock-free and may be called by several threads at the same time.
+class Arena {
+public:
+    Arena() : _current(nullptr), _blocks(nullptr), _memory_usage(0) {}
+    ~Arena() {
+        Block* b = _blocks.load(std::memory_order_acquire);
+        while (b) {
+            Block* next = b->next;
+            free(b);
+            b = next;
+        }
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+public:
+    // return bytes of memory aligned to align (a power of two, at most a cache line),
+    // the first hot_bytes of it don't straddle a cache line if they fit in one
+    void* allocate(size_t bytes, size_t align, size_t hot_bytes = 0);
+    // the total size of the blocks allocated so far
+    size_t memory_usage() const { return _memory_usage.load(std::memory_order_relaxed); }
+private:
+    static const size_t kBlockSize = 64 * 1024;
+
+    struct Block {
+        // link of the all blocks list, immutable once the block is published
+        Block* next;
+        size_t capacity;
+        std::atomic<size_t> used;
+        // the data starts at the first cache line after the header
+        char* data() {
+            return reinterpret_cast<char*>(this) + kHeaderSize;
+        }
+    };
+    static const size_t kHeaderSize = (sizeof(Block) + CACHE_LINE_SIZE - 1) & ~size_t(CACHE_LINE_SIZE - 1);
+
+    // the block small allocations are bumped from
+    std::atomic<Block*> _current;
+    // every block, to free them in bulk
+    std::atomic<Block*> _blocks;
+    std::atomic<size_t> _memory_usage;
+private:
+    static size_t align_up(size_t n, size_t align) {
+        return (n + align - 1) & ~(align - 1);
+    }
+    // where an allocation starting at offset n or later may start
+    static size_t placement(size_t n, size_t align, size_t hot_bytes) {
+        size_t start = align_up(n, align);
+        if ((hot_bytes <= CACHE_LINE_SIZE) &&
+            ((start % CACHE_LINE_SIZE) + hot_bytes > CACHE_LINE_SIZE)) {
+            start = align_up(start, CACHE_LINE_SIZE);
+        }
+        return start;
+    }
+    // bump an allocation out of b, return nullptr if it doesn't fit
+    static char* try_allocate(Block* b, size_t bytes, size_t align, size_t hot_bytes) {
+        size_t used = b->used.load(std::memory_order_relaxed);
+        while (true) {
+            size_t start = placement(used, align, hot_bytes);
+            if (start + bytes > b->capacity) {
+                return nullptr;
+            }
+            if (b->used.compare_exchange_weak(used, start + bytes, std::memory_order_relaxed)) {
+                return b->data() + start;
+            }
+        }
+    }
+    Block* new_block(size_t capacity);
+    // add a block to the all blocks list
+    void keep_block(Block* b);
+};
+
+inline void* Arena::allocate(size_t bytes, size_t align, size_t hot_bytes) {
+    assert((align & (align - 1)) == 0 && (align <= CACHE_LINE_SIZE));
+    // large allocations get a block of their own, so the current block
+    // isn't given up with most of it unused
+    if (bytes > kBlockSize / 4) {
+        Block* b = new_block(bytes);
+        keep_block(b);
+        return try_allocate(b, bytes, align, 0);
+    }
+
+    Block* b = _current.load(std::memory_order_acquire);
+    while (true) {
+        if (b) {
+            char* p = try_allocate(b, bytes, align, hot_bytes);
+            if (p) {
+                return p;
+            }
+        }
+        // the current block is full, only one of the racing threads
+        // installs its new block, the others retry in it
+        Block* fresh = new_block(kBlockSize);
+        if (_current.compare_exchange_strong(b, fresh, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+            keep_block(fresh);
+            b = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+}
+
+inline Arena::Block* Arena::new_block(size_t capacity) {
+    void* mem = aligned_alloc(CACHE_LINE_SIZE, align_up(kHeaderSize + capacity, CACHE_LINE_SIZE));
+    if (!mem) {
+        throw std::bad_alloc();
+    }
+    Block* b = new (mem) Block();
+    b->capacity = capacity;
+    b->used.store(0, std::memory_order_relaxed);
+    return b;
+}
+
+inline void Arena::keep_block(Block* b) {
+    Block* top = _blocks.load(std::memory_order_relaxed);
+    do {
+        b->next = top;
+    } while (!_blocks.compare_exchange_weak(top, b, std::memory_order_release,
+                                            std::memory_order_relaxed));
+    _memory_usage.fetch_add(kHeaderSize + b->capacity, std::memory_order_relaxed);
+}
+
+#endif //SKIPLIST_CHENFEI_ARENA_HPP
@@ -0,0 +1,104 @@
+//
+// Created by chenfeiwang on 4/27/22.
+//
+
+#ifndef SKIPLIST_CHENFEI_AUGMENTATIONS_HPP
+#define SKIPLIST_CHENFEI_AUGMENTATIONS_HPP
+
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+
+// An augmentation keeps a summary on every level of a node's tower,
+// the summary of level l covers the span of level 0 nodes after the
+// node's predecessor on level l, up to and including the node itself:
+// - Summary is the summary type, it must be trivially copyable and fit in
+//   8 bytes, so that the atomics holding it are lock-free
+// - of(key, value) is the summary of a single node, that is its level 0 span,
+//   kValueDependent tells whether a new value changes it
+// - combine(a, b) joins two adjacent spans, identity() is the empty span
+// - kWidths tells whether width(s) is the number of nodes a span covers,
+//   for rank and select
+// A skiplist with an enabled augmentation serializes its writers,
+// so that every span is recomputed from the level below,
+// its point readers stay lock-free, the readers of summaries retry
+// when a write ran meanwhile.
+
+// keep nothing, the towers carry no summaries and writers run concurrently
+struct NoAugmentation {
+    static constexpr bool kEnabled = false;
+    static constexpr bool kValueDependent = false;
+    static constexpr bool kWidths = false;
+
+    typedef size_t Summary;
+    template<class Key, class Value>
+    static Summary of(const Key& key, const Value& value) { return 0; }
+    static Summary combine(const Summary& a, const Summary& b) { return 0; }
+    static Summary identity() { return 0; }
+    static size_t width(const Summary& s) { return 0; }
+};
+
+// count the nodes of every span, as in Pugh's indexable skiplist,
+// for rank, select and count_range in O(log n)
+struct IndexAugmentation {
+    static constexpr bool kEnabled = true;
+    static constexpr bool kValueDependent = false;
+    static constexpr bool kWidths = true;
+
+    typedef size_t Summary;
+    template<class Key, class Value>
+    static Summary of(const Key& key, const Value& value) { return 1; }
+    static Summary combine(const Summary& a, const Summary& b) { return a + b; }
+    static Summary identity() { return 0; }
+    static size_t width(const Summary& s) { return s; }
+};
+
+// A monoid folds the values of a range:
+// - Type is the folded type, combine(a, b) is associative
+//   and identity() is its neutral element
+// - of(value) is the fold of a single value
+
+template<class T>
+struct SumMonoid {
+    typedef T Type;
+    static T identity() { return T(0); }
+    static T combine(const T& a, const T& b) { return a + b; }
+    template<class Value>
+    static T of(const Value& value) { return T(value); }
+};
+
+template<class T>
+struct MinMonoid {
+    typedef T Type;
+    static T identity() { return std::numeric_limits<T>::max(); }
+    static T combine(const T& a, const T& b) { return std::min(a, b); }
+    template<class Value>
+    static T of(const Value& value) { return T(value); }
+};
+
+template<class T>
+struct MaxMonoid {
+    typedef T Type;
+    static T identity() { return std::numeric_limits<T>::lowest(); }
+    static T combine(const T& a, const T& b) { return std::max(a, b); }
+    template<class Value>
+    static T of(const Value& value) { return T(value); }
+};
+
+// fold the values of every span with Monoid, for aggregate(lo, hi) in O(log n)
+template<class Monoid>
+struct AggregateAugmentation {
+    static constexpr bool kEnabled = true;
+    static constexpr bool kValueDependent = true;
+    static constexpr bool kWidths = false;
+
+    typedef typename Monoid::Type Summary;
+    static_assert(sizeof(Summary) <= 8, "the summary of a span must fit in 8 bytes");
+    template<class Key, class Value>
+    static Summary of(const Key& key, const Value& value) { return Monoid::of(value); }
+    static Summary combine(const Summary& a, const Summary& b) { return Monoid::combine(a, b); }
+    static Summary identity() { return Monoid::identity(); }
+    static size_t width(const Summary& s) { return 0; }
+};
+
+#endif //SKIPLIST_CHENFEI_AUGMENTATIONS_HPP
@@ -0,0 +1,445 @@
+//
+// Created by chenfeiwang on 5/9/22.
+//
+
+#ifndef SKIPLIST_CHENFEI_FATSKIPLIST_HPP
+#define SKIPLIST_CHENFEI_FATSKIPLIST_HPP
+
+#include <atomic>
+#include <mutex>
+#include <limits>
+#include <cassert>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <algorithm>
+#include "Reclaimers.hpp"
+#include "Random.hpp"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// upper limit of the height of a fat skiplist,
+// a node covers many keys, so it can be lower than the one of Skiplist
+#define FAT_MAX_HEIGHT 20
+// a node's height rises by one with probability 1/FAT_PROBABILITY_DENOMINATOR
+#define FAT_PROBABILITY_DENOMINATOR 4
+
+// A skiplist whose nodes hold a sorted block of up to BlockSize integer keys,
+// so that a lookup hops over far fewer nodes and reads whole cache lines of keys,
+// the keys of a block are searched with SIMD compares where available.
+// A node covers the keys from its low key up to the low key of the next node,
+// a full node splits in two, a node that drains below a quarter
+// merges with a neighbour.
+// Writers are serialized, readers are lock-free: the blocks are immutable
+// once published, a write swaps in a new block, so a reader always sees
+// a whole block. A reader that meets a block whose keys moved on to a new node
+// follows it, one that meets a merged away node starts over.
+// Reclaimer must not free the nodes a reader may still step through
+// before the reader is gone, so HazardPointerReclamation is not supported.
+template<class Key, class Value, int BlockSize = 16, class Reclaimer = EpochReclamation>
+class FatSkiplist {
+    static_assert(std::is_integral<Key>::value, "the keys of a fat skiplist are integers");
+    static_assert((BlockSize >= 4) && (BlockSize % 4 == 0), "the block size is a multiple of 4");
+    static_assert(!std::is_same<Reclaimer, HazardPointerReclamation>::value,
+                  "readers step through unlinked nodes without protecting them");
+private:
+    typedef typename Reclaimer::Guard Guard;
+
+    // a sorted run of keys and their values, immutable once published
+    struct Block : public Reclaimable {
+        // the unused keys are the max of Key, so that no lane past count is below a key
+        alignas(32) Key keys[BlockSize];
+        Value values[BlockSize];
+        int count;
+        // when bounded, the keys >= high moved to a node after the one of this block
+        bool bounded;
+        Key high;
+        Block() : count(0), bounded(false), high(0) {
+            std::fill(keys, keys + BlockSize, std::numeric_limits<Key>::max());
+            reclaim = &Block::destroy;
+        }
+        static void destroy(Reclaimable* r) { delete static_cast<Block*>(r); }
+        bool covers(const Key& key) const { return !bounded || (key < high); }
+        // the number of keys < key
+        int rank(const Key& key) const;
+        void append(const Key& key, const Value& value) {
+            assert(count < BlockSize);
+            keys[count] = key;
+            values[count] = value;
+            count++;
+        }
+        void append(const Block* b, int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                append(b->keys[i], b->values[i]);
+            }
+        }
+    };
+
+    // a node is allocated with its tower, like the ones of Skiplist
+    class Node : public Reclaimable {
+    public:
+        // the smallest key the node covers, the head covers all keys below the next node
+        const Key low;
+        const int height;
+        std::atomic<Block*> block;
+    public:
+        Node* next(int level) {
+            assert((level >= 0) && (level < height));
+            return _next[level].load(std::memory_order_acquire);
+        }
+        void set_next(int level, Node* node) {
+            assert((level >= 0) && (level < height));
+            _next[level].store(node, std::memory_order_release);
+        }
+        static Node* create(const Key& low, int height, Block* block) {
+            void* mem = ::operator new(sizeof(Node) + (height - 1) * sizeof(std::atomic<Node*>));
+            return new (mem) Node(low, height, block);
+        }
+        static void destroy(Reclaimable* r) {
+            Node* n = static_cast<Node*>(r);
+            n->~Node();
+            ::operator delete(n);
+        }
+    private:
+        std::atomic<Node*> _next[1];
+    private:
+        Node(const Key& l, int h, Block* b) : low(l), height(h), block(b) {
+            for (int i = 0; i < height; i++) {
+                new (&_next[i]) std::atomic<Node*>(nullptr);
+            }
+            reclaim = &Node::destroy;
+        }
+    };
+public:
+    FatSkiplist() : _reclaimer(1), _height_state(0x2545f4914f6cdd1dULL), _cur_h(1), _size(0) {
+        _head = Node::create(std::numeric_limits<Key>::min(), FAT_MAX_HEIGHT, new Block());
+    }
+    ~FatSkiplist();
+    FatSkiplist(const FatSkiplist&) = delete;
+    FatSkiplist& operator=(const FatSkiplist&) = delete;
+public:
+    // insert a new key value pair, if the key exists, change the value
+    void insert(const Key& key, const Value& value);
+    // erase a key value pair, if the key does not exist, return false
+    bool erase(const Key& key);
+    // read value according to key, if the key does not exist, return false
+    bool read(const Key& key, Value& value);
+    size_t size() { return _size.load(std::memory_order_relaxed); }
+    // the number of nodes, the head included
+    size_t node_count();
+private:
+    Reclaimer _reclaimer;
+    // serializes the writers
+    std::mutex _write_lock;
+    // state of the height generator, only used by the writer
+    uint64_t _height_state;
+    std::atomic<int> _cur_h;
+    std::atomic<size_t> _size;
+    Node* _head;
+    // stands in for the block of a node that was merged away
+    Block _dead;
+private:
+    int random_height() {
+        // one draw gives every level
+        uint64_t r = wyrand(_height_state);
+        int h = 1;
+        while ((h < FAT_MAX_HEIGHT) && (r % FAT_PROBABILITY_DENOMINATOR == 0)) {
+            r /= FAT_PROBABILITY_DENOMINATOR;
+            h++;
+        }
+        return h;
+    }
+    // find the last node whose low key is <= key, or < key if not inclusive,
+    // the head counts as below every key,
+    // if preds is not null, record the last such node on each level
+    Node* find_last(const Key& key, bool inclusive, Node** preds);
+    // publish block as the one of n, retire the old one
+    void publish(Guard& guard, Node* n, Block* block) {
+        Block* old = n->block.exchange(block, std::memory_order_acq_rel);
+        guard.retire(old);
+    }
+    // split the full node n while inserting key at pos of its block,
+    // preds are the ones of key
+    void split(Guard& guard, Node* n, Node** preds, int pos, const Key& key, const Value& value);
+    // move the keys of right into left, merged is the block of both,
+    // then unlink right
+    void merge(Guard& guard, Node* left, Node* right, Block* merged);
+};
+
+template<class Key, class Value, int BlockSize, class Reclaimer>
+int FatSkiplist<Key, Value, BlockSize, Reclaimer>::Block::rank(const Key& key) const {
+    // the signed key types with SIMD compares, named in the branches
+    // using them only, so that none goes unused without SIMD
+#if defined(__AVX2__)
+    {
+        constexpr bool kInt32 = std::is_signed<Key>::value && (sizeof(Key) == 4);
+        constexpr bool kInt64 = std::is_signed<Key>::value && (sizeof(Key) == 8);
+        if constexpr (kInt32 && (BlockSize % 8 == 0)) {
+            __m256i k = _mm256_set1_epi32(key);
+            int n = 0;
+            for (int i = 0; i < BlockSize; i += 8) {
+                __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys + i));
+                n += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v))));
+            }
+            return n;
+        }
+        if constexpr (kInt64) {
+            __m256i k = _mm256_set1_epi64x(key);
+            int n = 0;
+            for (int i = 0; i < BlockSize; i += 4) {
+                __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys + i));
+                n += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v))));
+            }
+            return n;
+        }
+    }
+#endif
+#if defined(__SSE4_2__)
+    {
+        constexpr bool kInt64 = std::is_signed<Key>::value && (sizeof(Key) == 8);
+        if constexpr (kInt64) {
+            __m128i k = _mm_set1_epi64x(key);
+            int n = 0;
+            for (int i = 0; i < BlockSize; i += 2) {
+                __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(keys + i));
+                n += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(k, v))));
+            }
+            return n;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        constexpr bool kInt32 = std::is_signed<Key>::value && (sizeof(Key) == 4);
+        if constexpr (kInt32) {
+            __m128i k = _mm_set1_epi32(key);
+            int n = 0;
+            for (int i = 0; i < BlockSize; i += 4) {
+                __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(keys + i));
+                n += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v))));
+            }
+            return n;
+        }
+    }
+#endif
+    // the other key types, or no SIMD: a branch free count the compiler may vectorize
+    int n = 0;
+    for (int i = 0; i < BlockSize; i++) {
+        n += keys[i] < key;
+    }
+    return n;
+}
+
+template<class Key, class Value, int BlockSize, class Reclaimer>
+FatSkiplist<Key, Value, BlockSize, Reclaimer>::~FatSkiplist() {
+    Node* n = _head;
+    while (n) {
+        Node* next = n->next(0);
+        Block* b = n->block.load(std::memory_order_relaxed);
+        if (b != &_dead) {
+            delete b;
+        }
+        Node::destroy(n);
+        n = next;
+    }
+}
+
+template<class Key, class Value, int BlockSize, class Reclaimer>
+typename FatSkiplist<Key, Value, BlockSize, Reclaimer>::Node*
+FatSkiplist<Key, Value, BlockSize, Reclaimer>::find_last(const Key& key, bool inclusive, Node** preds) {
+    Node* p = _head;
+    for (int level = _cur_h.load(std::memory_order_acquire) - 1; level >= 0; level--) {
+        Node* next = p->next(level);
+        while (next && (inclusive ? !(key < next->low) : (next->low < key))) {
+            p = next;
+            next = p->next(level);
+        }
+        if (preds) {
+            preds[level] = p;
+        }
+    }
+    return p;
+}
+
+template<class Key, class Value, int BlockSize, class Reclaimer>
+bool FatSkiplist<Key, Value, BlockSize, Reclaimer>::read(const Key& key, Value& value) {
+    Guard guard(_reclaimer);
+retry:
+    Node* n = find_last(key, true, nullptr);
+    Block* b = guard.protect(0, n->block);
+    while (b != &_dead && !b->covers(key)) {
+        // a split moved the key to the next node, which was linked before
+        // the block was swapped, unless a merge unlinked it meanwhile
+        n = n->next(0);
+        if (!n || (key < n->low)) {
+            goto retry;
+        }
+        b = guard.protect(0, n->block);
+    }
+    if (b == &_dead) {
+        // n was merged away, its keys are in the node before it
+        goto retry;
+    }
+    int pos = b->rank(key);
+    if ((pos < b->count) && (b->keys[pos] == key)) {
+        value = b->values[pos];
+        return true;
+    }
+    return false;
+}
+
+template<class Key, class Value, int BlockSize, class Reclaimer>
+void FatSkiplist<Key, Value, BlockSize, Reclaimer>::insert(const Key& key, const Value& value) {
+    std::lock_guard<std::mutex> lock(_write_lock);
+    Guard guard(_reclaimer);
+    Node* preds[FAT_MAX_HEIGHT];
+    Node* n = find_last(key, true, preds);
+    Block* b = n->block.load(std::memory_order_relaxed);
+    int pos = b->rank(key);
+    if ((pos < b->count) && (b->keys[pos] == key)) {
+        Block* updated = new Block(*b);
+        updated->values[pos] = value;
+        publish(guard, n, updated);
+        return;
+    }
+
+    _size.fetch_add(1, std::memory_order_relaxed);
+    if (b->count == BlockSize) {
+        split(guard, n, preds, pos, key, value);
+        return;
+    }
+    Block* inserted = new Block();
+    inserted->bounded = b->bounded;
+    inserted->high = b->high;
+    inserted->append(b, 0, pos);
+    inserted->append(key, value);
+    inserted->append(b, pos, b->count);
+    publish(guard, n, inserted);
+}
+
+template<class Key, class Value, int BlockSize, class Reclaimer>
+void FatSkiplist<Key, Value, BlockSize, Reclaimer>::split(Guard& guard,
+                                                          Node* n,
+                                                          Node** preds,
+                                                          int pos,
+                                                          const Key& key,
+                                                          const Value& value) {
+    Block* b = n->block.load(std::memory_order_relaxed);
+    // the BlockSize + 1 keys with the new one, the upper half goes to a new node
+    Block* left = new Block();
+    Block* right = new Block();
+    int half = (BlockSize + 1) / 2;
+    for (int i = 0; i <= BlockSize; i++) {
+        Block* to = i < half ? left : right;
+        if (i < pos) {
+            to->append(b->keys[i], b->values[i]);
+        } else if (i == pos) {
+            to->append(key, value);
+        } else {
+            to->append(b->keys[i - 1], b->values[i - 1]);
+        }
+    }
+    right->bounded = b->bounded;
+    right->high = b->high;
+    left->bounded = true;
+    left->high = right->keys[0];
+
+    // no node starts between n and the new node, so the preds of key
+    // are the ones of the new node as well
+    int height = random_height();
+    for (int level = _cur_h.load(std::memory_order_relaxed); level < height; level++) {
+        preds[level] = _head;
+    }
+    Node* fresh = Node::create(right->keys[0], height, right);
+    for (int level = 0; level < height; level++) {
+        fresh->set_next(level, preds[level]->next(level));
+    }
+    // a reader that sees the left block follows the link to the right one
+    n->set_next(0, fresh);
+    publish(guard, n, left);
+    for (int level = 1; level < height; level++) {
+        preds[level]->set_next(level, fresh);
+    }
+    if (height > _cur_h.load(std::memory_order_relaxed)) {
+        _cur_h.store(height, std::memory_order_release);
+    }
+}
+
+template<class Key, class Value, int BlockSize, class Reclaimer>
+bool FatSkiplist<Key, Value, BlockSize, Reclaimer>::erase(const Key& key) {
+    std::lock_guard<std::mutex> lock(_write_lock);
+    Guard guard(_reclaimer);
+    Node* n = find_last(key, true, nullptr);
+    Block* b = n->block.load(std::memory_order_relaxed);
+    int pos = b->rank(key);
+    if ((pos >= b->count) || (b->keys[pos] != key)) {
+        return false;
+    }
+
+    _size.fetch_sub(1, std::memory_order_relaxed);
+    Block* erased = new Block();
+    erased->bounded = b->bounded;
+    erased->high = b->high;
+    erased->append(b, 0, pos);
+    erased->append(b, pos + 1, b->count);
+    if (erased->count < BlockSize / 4) {
+        // merge with the next node, or else into the previous one
+        Node* next = n->next(0);
+        Block* nb = next ? next->block.load(std::memory_order_relaxed) : nullptr;
+        Node* prev = n == _head ? nullptr : find_last(n->low, false, nullptr);
+        Block* pb = prev ? prev->block.load(std::memory_order_relaxed) : nullptr;
+        if (nb && (erased->count + nb->count <= BlockSize)) {
+            Block* merged = new Block();
+            merged->bounded = nb->bounded;
+            merged->high = nb->high;
+            merged->append(erased, 0, erased->count);
+            merged->append(nb, 0, nb->count);
+            delete erased;
+            merge(guard, n, next, merged);
+            return true;
+        }
+        if (pb && (pb->count + erased->count <= BlockSize)) {
+            Block* merged = new Block();
+            merged->bounded = erased->bounded;
+            merged->high = erased->high;
+            merged->append(pb, 0, pb->count);
+            merged->append(erased, 0, erased->count);
+            delete erased;
+            merge(guard, prev, n, merged);
+            return true;
+        }
+    }
+    publish(guard, n, erased);
+    return true;
+}
+
+template<class Key, class Value, int BlockSize, class Reclaimer>
+void FatSkiplist<Key, Value, BlockSize, Reclaimer>::merge(Guard& guard,
+                                                          Node* left,
+                                                          Node* right,
+                                                          Block* merged) {
+    // both blocks hold the keys of right until it is unlinked,
+    // a reader that loads the block of right after that starts over
+    publish(guard, left, merged);
+    Node* preds[FAT_MAX_HEIGHT];
+    find_last(right->low, false, preds);
+    for (int level = 0; level < right->height; level++) {
+        assert(preds[level]->next(level) == right);
+        preds[level]->set_next(level, right->next(level));
+    }
+    publish(guard, right, &_dead);
+    guard.retire(right);
+}
+
+template<class Key, class Value, int BlockSize, class Reclaimer>
+size_t FatSkiplist<Key, Value, BlockSize, Reclaimer>::node_count() {
+    Guard guard(_reclaimer);
+    size_t count = 0;
+    for (Node* n = _head; n; n = n->next(0)) {
+        count++;
+    }
+    return count;
+}
+
+#endif //SKIPLIST_CHENFEI_FATSKIPLIST_HPP
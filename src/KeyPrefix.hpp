@@ -0,0 +1,103 @@
+//
+// Created by chenfeiwang on 5/6/22.
+//
+
+#ifndef SKIPLIST_CHENFEI_KEYPREFIX_HPP
+#define SKIPLIST_CHENFEI_KEYPREFIX_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+// KeyPrefix<Key, Compare> maps a key to 8 bytes whose unsigned order agrees
+// with Compare: prefix(a) < prefix(b) implies a < b,
+// so a search compares the prefixes first and only compares the keys on a tie,
+// kEnabled tells whether the nodes cache the prefix of their key
+template<class Key, class Compare>
+struct KeyPrefix {
+    static constexpr bool kEnabled = false;
+    template<class K>
+    static uint64_t of(const K& key) { return 0; }
+};
+
+// the first 8 bytes of a string, big-endian and zero padded,
+// it agrees with the byte order std::string compares in
+struct StringKeyPrefix {
+    static constexpr bool kEnabled = true;
+    static uint64_t of(std::string_view key) {
+        uint64_t p = 0;
+        if (key.size() >= sizeof(p)) {
+            memcpy(&p, key.data(), sizeof(p));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            p = __builtin_bswap64(p);
+#endif
+            return p;
+        }
+        for (size_t i = 0; i < key.size(); i++) {
+            p |= uint64_t((unsigned char)key[i]) << (56 - 8 * i);
+        }
+        return p;
+    }
+};
+
+template<>
+struct KeyPrefix<std::string, std::less<>> : public StringKeyPrefix {};
+template<>
+struct KeyPrefix<std::string, std::less<std::string>> : public StringKeyPrefix {};
+
+// IntegerKey<Key, Compare> maps integer keys ordered by std::less
+// to uint64_t in the same order, key_of is its inverse and takes
+// the values below or above those of all keys to the least or greatest key,
+// kEnabled tells whether Key and Compare are such
+template<class Key, class Compare, class = void>
+struct IntegerKey {
+    static constexpr bool kEnabled = false;
+    static uint64_t of(const Key& key) { return 0; }
+    static Key key_of(uint64_t u) { return Key(); }
+};
+
+// the signed keys have their sign bit flipped, so that negative keys come first
+template<class Key>
+struct IntegralKey {
+    static constexpr bool kEnabled = true;
+    static constexpr uint64_t kSignFlip = std::is_signed<Key>::value ? uint64_t(1) << 63 : 0;
+    static uint64_t of(const Key& key) {
+        return std::is_signed<Key>::value ? uint64_t(int64_t(key)) ^ kSignFlip : uint64_t(key);
+    }
+    static Key key_of(uint64_t u) {
+        uint64_t lo = of(std::numeric_limits<Key>::min());
+        uint64_t hi = of(std::numeric_limits<Key>::max());
+        u = u < lo ? lo : (u > hi ? hi : u);
+        return std::is_signed<Key>::value ? Key(int64_t(u ^ kSignFlip)) : Key(u);
+    }
+};
+
+template<class Key>
+struct IntegerKey<Key, std::less<>, typename std::enable_if<std::is_integral<Key>::value>::type>
+    : public IntegralKey<Key> {};
+template<class Key>
+struct IntegerKey<Key, std::less<Key>, typename std::enable_if<std::is_integral<Key>::value>::type>
+    : public IntegralKey<Key> {};
+
+// the part of a node holding the prefix, it is empty when it is not cached
+template<bool Cached>
+class NodePrefix {
+public:
+    explicit NodePrefix(uint64_t prefix) {}
+    uint64_t key_prefix() const { return 0; }
+};
+
+template<>
+class NodePrefix<true> {
+public:
+    explicit NodePrefix(uint64_t prefix) : _prefix(prefix) {}
+    uint64_t key_prefix() const { return _prefix; }
+private:
+    const uint64_t _prefix;
+};
+
+#endif //SKIPLIST_CHENFEI_KEYPREFIX_HPP
@@ -0,0 +1,18 @@
+//
+// Created by chenfeiwang on 5/9/22.
+//
+
+#ifndef SKIPLIST_CHENFEI_RANDOM_HPP
+#define SKIPLIST_CHENFEI_RANDOM_HPP
+
+#include <cstdint>
+
+// one step of wyrand: advance state and return 64 random bits,
+// fast enough that a node height costs a single draw
+inline uint64_t wyrand(uint64_t& state) {
+    state += 0xa0761d6478bd642fULL;
+    __uint128_t t = (__uint128_t)state * (state ^ 0xe7037ed1a0b428dbULL);
+    return (uint64_t)(t >> 64) ^ (uint64_t)t;
+}
+
+#endif //SKIPLIST_CHENFEI_RANDOM_HPP
@@ -0,0 +1,509 @@
+//
+// Created by chenfeiwang on 4/12/22.
+//
+
+#ifndef SKIPLIST_CHENFEI_RECLAIMERS_HPP
+#define SKIPLIST_CHENFEI_RECLAIMERS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <thread>
+
+// objects handed to a reclaimer embed this hook as their first base,
+// so that retiring an object never allocates,
+// and the hook's address is the object's address
+struct Reclaimable {
+    // link of the retired list the object sits in
+    Reclaimable* next_retired = nullptr;
+    // the epoch the object was retired in, only used by EpochReclamation
+    uint64_t retire_epoch = 0;
+    // destroy and free the object
+    void (*reclaim)(Reclaimable*) = nullptr;
+};
+
+// free a whole retired list
+inline void reclaim_all(Reclaimable* r) {
+    while (r) {
+        Reclaimable* next = r->next_retired;
+        r->reclaim(r);
+        r = next;
+    }
+}
+
+// the lowest bit of a shared pointer may be used as a tag,
+// reclaimers ignore it when comparing pointers
+inline void* untagged(void* p) {
+    return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(1));
+}
+
+// A reclaimer decides when an object unlinked from a lock-free structure
+// can be freed. Every access to the structure happens inside a Guard:
+// - protect(slot, src) loads a shared pointer, the object it points to
+//   stays valid while the slot keeps it or the guard is alive
+// - set(slot, p) moves a pointer that is already protected to another slot
+// - retire(r) hands over an object that is unlinked from the structure
+// A reclaimer is constructed with the number of slots a guard may use,
+// and tells by kReclaimsEarly whether retired objects may be freed
+// before the reclaimer itself is destroyed, and by kGuardKeepsAll whether
+// a guard keeps every object it met alive, not only the ones in its slots.
+
+// never free a retired object until the reclaimer itself is destroyed,
+// the cheapest mode, but memory grows with the total number of erases,
+// and in a skiplist with the number of values replaced by updates
+class NoReclamation {
+public:
+    static constexpr bool kReclaimsEarly = false;
+    static constexpr bool kGuardKeepsAll = true;
+
+    class Guard {
+    public:
+        explicit Guard(NoReclamation& domain) : _domain(domain) {}
+        template<class T>
+        T* protect(int slot, const std::atomic<T*>& src) { return src.load(std::memory_order_acquire); }
+        void set(int slot, void* p) {}
+        void retire(Reclaimable* r) {
+            Reclaimable* top = _domain._retired.load(std::memory_order_relaxed);
+            do {
+                r->next_retired = top;
+            } while (!_domain._retired.compare_exchange_weak(top, r, std::memory_order_release,
+                                                             std::memory_order_relaxed));
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    private:
+        NoReclamation& _domain;
+    };
+public:
+    explicit NoReclamation(size_t slots = 0) : _retired(nullptr) {}
+    ~NoReclamation() { reclaim_all(_retired.load(std::memory_order_acquire)); }
+    NoReclamation(const NoReclamation&) = delete;
+    NoReclamation& operator=(const NoReclamation&) = delete;
+private:
+    std::atomic<Reclaimable*> _retired;
+};
+
+// epoch based reclamation:
+// a guard pins the global epoch it entered in, the global epoch advances
+// only when every pinned guard has seen the current one, and an object
+// retired in epoch e is freed once the global epoch reaches e + 2,
+// because no guard can still hold a reference to it then.
+// A guard that retired objects tries to advance the epoch when it exits,
+// so the garbage is freed a couple of operations after the last guard
+// that could see it is gone. A guard stalled while pinned keeps everything
+// retired meanwhile alive, a guard exiting with a lot of garbage yields
+// for a while so that a preempted one can finish.
+class EpochReclamation {
+private:
+    // the epoch of a record whose guard is gone
+    static constexpr uint64_t kIdle = UINT64_MAX;
+    // try to advance the epoch and free, also in the records nobody holds,
+    // after this many new retires within guards, by default
+    static constexpr size_t kRetireThreshold = 128;
+    // a guard exiting with more than this many retire thresholds of objects
+    // it could not free yields up to kBackOffYields times
+    static constexpr size_t kBackOffBatches = 4;
+    static constexpr int kBackOffYields = 16;
+public:
+    static constexpr bool kReclaimsEarly = true;
+    static constexpr bool kGuardKeepsAll = true;
+private:
+
+    // per guard state, records are never freed before the reclaimer,
+    // a guard takes a free record and gives it back when it is destroyed
+    struct Record {
+        std::atomic<uint64_t> epoch;
+        std::atomic<bool> in_use;
+        // immutable once the record is published
+        Record* next;
+        // owned by the guard holding the record, newest first
+        Reclaimable* retired;
+        // the retire epoch of the last, oldest one of them
+        uint64_t oldest;
+        size_t retired_num;
+        // retires since the last attempt to advance the epoch within a guard
+        size_t since_advance;
+        // yield to the stalled guards once retired_num exceeds it, see back_off
+        size_t back_off_at;
+        explicit Record(size_t threshold) : epoch(kIdle), in_use(true), next(nullptr), retired(nullptr),
+                                            oldest(0), retired_num(0), since_advance(0),
+                                            back_off_at(kBackOffBatches * threshold) {}
+    };
+public:
+    class Guard {
+    public:
+        explicit Guard(EpochReclamation& domain) : _domain(domain), _record(domain.acquire()) {
+            _record->epoch.store(domain._epoch.load(std::memory_order_relaxed),
+                                 std::memory_order_relaxed);
+            // the pin must be visible before any shared pointer is read
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        ~Guard() {
+            _record->epoch.store(kIdle, std::memory_order_release);
+            // the pin of this guard may have been the last one holding the epoch back
+            if (_record->retired) {
+                _domain.try_advance();
+                _domain.collect(_record);
+                _domain.back_off(_record);
+            }
+            _record->in_use.store(false, std::memory_order_release);
+        }
+        // the pinned epoch already keeps everything reachable alive
+        template<class T>
+        T* protect(int slot, const std::atomic<T*>& src) { return src.load(std::memory_order_acquire); }
+        void set(int slot, void* p) {}
+        void retire(Reclaimable* r) {
+            r->retire_epoch = _domain._epoch.load(std::memory_order_acquire);
+            if (!_record->retired) {
+                _record->oldest = r->retire_epoch;
+            }
+            r->next_retired = _record->retired;
+            _record->retired = r;
+            _record->retired_num++;
+            if (++_record->since_advance >= _domain._retire_threshold) {
+                _record->since_advance = 0;
+                _domain.try_advance();
+                _domain.collect(_record);
+                _domain.collect_idle();
+            }
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    private:
+        EpochReclamation& _domain;
+        Record* _record;
+    };
+public:
+    // a small retire_threshold suits few but large objects, the ones retired
+    // by a guard that does not exit soon, or left in the record of one that
+    // exited too early to free them, are freed a couple of retires after
+    // no guard can hold them any more
+    explicit EpochReclamation(size_t slots = 0, size_t retire_threshold = kRetireThreshold)
+        : _epoch(0), _records(nullptr), _id(next_id()), _retire_threshold(retire_threshold) {}
+    ~EpochReclamation() {
+        Record* r = _records.load(std::memory_order_acquire);
+        while (r) {
+            Record* next = r->next;
+            reclaim_all(r->retired);
+            delete r;
+            r = next;
+        }
+    }
+    EpochReclamation(const EpochReclamation&) = delete;
+    EpochReclamation& operator=(const EpochReclamation&) = delete;
+private:
+    std::atomic<uint64_t> _epoch;
+    std::atomic<Record*> _records;
+    // identifies this reclaimer in the thread local record cache,
+    // unlike its address it is never reused
+    const uint64_t _id;
+    const size_t _retire_threshold;
+private:
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> id(0);
+        return id.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    struct CachedRecord {
+        uint64_t id;
+        Record* record;
+    };
+    // a thread mostly gets back the record it used last time
+    static CachedRecord& cached_record() {
+        static thread_local CachedRecord cache = {0, nullptr};
+        return cache;
+    }
+    static bool try_take(Record* r) {
+        bool expected = false;
+        return !r->in_use.load(std::memory_order_relaxed) &&
+               r->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire,
+                                                 std::memory_order_relaxed);
+    }
+    Record* acquire() {
+        CachedRecord& cache = cached_record();
+        if ((cache.id == _id) && try_take(cache.record)) {
+            return cache.record;
+        }
+        Record* r = _records.load(std::memory_order_acquire);
+        while (r && !try_take(r)) {
+            r = r->next;
+        }
+        if (!r) {
+            r = new Record(_retire_threshold);
+            Record* top = _records.load(std::memory_order_relaxed);
+            do {
+                r->next = top;
+            } while (!_records.compare_exchange_weak(top, r, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+        }
+        cache.id = _id;
+        cache.record = r;
+        return r;
+    }
+    // advance the global epoch if every pinned guard has seen it
+    void try_advance() {
+        // pairs with the fence of the guard, objects unlinked before
+        // are unreachable for a guard whose pin is missed below
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t e = _epoch.load(std::memory_order_seq_cst);
+        for (Record* r = _records.load(std::memory_order_acquire); r; r = r->next) {
+            uint64_t pinned = r->epoch.load(std::memory_order_seq_cst);
+            if ((pinned != kIdle) && (pinned != e)) {
+                return;
+            }
+        }
+        _epoch.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst);
+    }
+    // records nobody holds keep their objects until they are taken again,
+    // free what has expired in them as well
+    void collect_idle() {
+        for (Record* r = _records.load(std::memory_order_acquire); r; r = r->next) {
+            if (try_take(r)) {
+                collect(r);
+                r->in_use.store(false, std::memory_order_release);
+            }
+        }
+    }
+    // the thread of a guard pinned in an old epoch, mostly one that was
+    // preempted, holds back every retired object, so with more threads
+    // than cores the garbage would grow with the writes of a time slice:
+    // give it the core for a while, a guard held on purpose for long,
+    // e.g. by an iterator, makes this record wait for twice the objects
+    // before it yields again
+    void back_off(Record* record) {
+        size_t limit = kBackOffBatches * _retire_threshold;
+        for (int i = 0; (i < kBackOffYields) && (record->retired_num > record->back_off_at); i++) {
+            std::this_thread::yield();
+            try_advance();
+            collect(record);
+        }
+        if (record->retired_num <= limit) {
+            record->back_off_at = limit;
+        } else if (record->retired_num > record->back_off_at) {
+            record->back_off_at = 2 * record->retired_num;
+        }
+    }
+    // free the objects of the record retired at least two epochs ago,
+    // the list is ordered by retire epoch, so they form its tail,
+    // it is only walked once its oldest object expired: while a stalled
+    // guard holds the epoch back, the objects kept are not scanned again
+    void collect(Record* record) {
+        uint64_t e = _epoch.load(std::memory_order_acquire);
+        if (!record->retired || (record->oldest + 2 > e)) {
+            return;
+        }
+        Reclaimable** link = &record->retired;
+        Reclaimable* last = nullptr;
+        size_t kept = 0;
+        while (*link && ((*link)->retire_epoch + 2 > e)) {
+            last = *link;
+            link = &last->next_retired;
+            kept++;
+        }
+        Reclaimable* expired = *link;
+        *link = nullptr;
+        if (last) {
+            record->oldest = last->retire_epoch;
+        }
+        record->retired_num = kept;
+        reclaim_all(expired);
+    }
+};
+
+// hazard pointer reclamation:
+// a guard publishes every pointer it is about to dereference in one of its
+// slots, and a retired object is freed once no slot holds it any more.
+// Unlike EpochReclamation a stalled guard only keeps the few objects
+// in its slots alive, so memory stays bounded, at the cost of a fence
+// for every protected load.
+class HazardPointerReclamation {
+private:
+    // scan the slots after at least this many new retires
+    static constexpr size_t kRetireThreshold = 128;
+public:
+    static constexpr bool kReclaimsEarly = true;
+    static constexpr bool kGuardKeepsAll = false;
+private:
+
+    // per guard state, records are never freed before the reclaimer,
+    // a guard takes a free record and gives it back when it is destroyed
+    struct Record {
+        std::atomic<bool> in_use;
+        // immutable once the record is published
+        Record* next;
+        std::atomic<void*>* hazards;
+        // owned by the guard holding the record
+        Reclaimable* retired;
+        size_t retired_num;
+        size_t collect_at;
+        explicit Record(size_t slots) : in_use(true), next(nullptr),
+                                        hazards(new std::atomic<void*>[slots]),
+                                        retired(nullptr), retired_num(0),
+                                        collect_at(kRetireThreshold) {
+            for (size_t i = 0; i < slots; i++) {
+                hazards[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        ~Record() { delete[] hazards; }
+    };
+public:
+    class Guard {
+    public:
+        explicit Guard(HazardPointerReclamation& domain) : _domain(domain),
+                                                           _record(domain.acquire()),
+                                                           _used(0) {}
+        ~Guard() {
+            for (int i = 0; i < _used; i++) {
+                _record->hazards[i].store(nullptr, std::memory_order_release);
+            }
+            _record->in_use.store(false, std::memory_order_release);
+        }
+        // publish the pointer, then check src still holds it,
+        // otherwise the object may have been retired before it was published
+        template<class T>
+        T* protect(int slot, const std::atomic<T*>& src) {
+            assert_slot(slot);
+            T* p = src.load(std::memory_order_acquire);
+            while (true) {
+                _record->hazards[slot].store(untagged(p), std::memory_order_seq_cst);
+                T* again = src.load(std::memory_order_seq_cst);
+                if (again == p) {
+                    return p;
+                }
+                p = again;
+            }
+        }
+        void set(int slot, void* p) {
+            assert_slot(slot);
+            _record->hazards[slot].store(untagged(p), std::memory_order_release);
+        }
+        void retire(Reclaimable* r) {
+            r->next_retired = _record->retired;
+            _record->retired = r;
+            if (++_record->retired_num >= _record->collect_at) {
+                _domain.collect(_record);
+                _domain.collect_idle();
+            }
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    private:
+        HazardPointerReclamation& _domain;
+        Record* _record;
+        // slots below it may be set, they are cleared with the guard
+        int _used;
+    private:
+        void assert_slot(int slot) {
+            assert((slot >= 0) && ((size_t)slot < _domain._slots));
+            _used = std::max(_used, slot + 1);
+        }
+    };
+public:
+    explicit HazardPointerReclamation(size_t slots) : _slots(slots), _records(nullptr),
+                                                      _record_num(0), _id(next_id()) {}
+    ~HazardPointerReclamation() {
+        Record* r = _records.load(std::memory_order_acquire);
+        while (r) {
+            Record* next = r->next;
+            reclaim_all(r->retired);
+            delete r;
+            r = next;
+        }
+    }
+    HazardPointerReclamation(const HazardPointerReclamation&) = delete;
+    HazardPointerReclamation& operator=(const HazardPointerReclamation&) = delete;
+private:
+    // the number of slots of each guard
+    const size_t _slots;
+    std::atomic<Record*> _records;
+    std::atomic<size_t> _record_num;
+    // identifies this reclaimer in the thread local record cache
+    const uint64_t _id;
+private:
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> id(0);
+        return id.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    struct CachedRecord {
+        uint64_t id;
+        Record* record;
+    };
+    static CachedRecord& cached_record() {
+        static thread_local CachedRecord cache = {0, nullptr};
+        return cache;
+    }
+    static bool try_take(Record* r) {
+        bool expected = false;
+        return !r->in_use.load(std::memory_order_relaxed) &&
+               r->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire,
+                                                 std::memory_order_relaxed);
+    }
+    Record* acquire() {
+        CachedRecord& cache = cached_record();
+        if ((cache.id == _id) && try_take(cache.record)) {
+            return cache.record;
+        }
+        Record* r = _records.load(std::memory_order_acquire);
+        while (r && !try_take(r)) {
+            r = r->next;
+        }
+        if (!r) {
+            r = new Record(_slots);
+            Record* top = _records.load(std::memory_order_relaxed);
+            do {
+                r->next = top;
+            } while (!_records.compare_exchange_weak(top, r, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+            _record_num.fetch_add(1, std::memory_order_relaxed);
+        }
+        cache.id = _id;
+        cache.record = r;
+        return r;
+    }
+    void collect_idle() {
+        for (Record* r = _records.load(std::memory_order_acquire); r; r = r->next) {
+            if (try_take(r)) {
+                collect(r);
+                r->in_use.store(false, std::memory_order_release);
+            }
+        }
+    }
+    // free the objects of the record that no slot holds
+    void collect(Record* record) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<void*> hazards;
+        for (Record* r = _records.load(std::memory_order_acquire); r; r = r->next) {
+            for (size_t i = 0; i < _slots; i++) {
+                void* p = r->hazards[i].load(std::memory_order_seq_cst);
+                if (p) {
+                    hazards.push_back(p);
+                }
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        Reclaimable* r = record->retired;
+        Reclaimable* kept = nullptr;
+        size_t kept_num = 0;
+        while (r) {
+            Reclaimable* next = r->next_retired;
+            if (std::binary_search(hazards.begin(), hazards.end(), (void*)r)) {
+                r->next_retired = kept;
+                kept = r;
+                kept_num++;
+            } else {
+                r->reclaim(r);
+            }
+            r = next;
+        }
+        record->retired = kept;
+        record->retired_num = kept_num;
+        // a scan costs all the slots, make it pay off with as many retires
+        size_t slots = _slots * _record_num.load(std::memory_order_relaxed);
+        record->collect_at = kept_num + (slots > kRetireThreshold ? slots : kRetireThreshold);
+    }
+};
+
+#endif //SKIPLIST_CHENFEI_RECLAIMERS_HPP
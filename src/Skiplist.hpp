@@ -7,93 +7,1159 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cmath>
 #include <atomic>
-#include <random>
 #include <iostream>
 #include <thread>
 #include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
 #include "../thirdparty/nlohmann_json/json.hpp"
 #include "Serializers.hpp"
+#include "Reclaimers.hpp"
+#include "Arena.hpp"
+#include "Augmentations.hpp"
+#include "KeyPrefix.hpp"
+#include "Random.hpp"
+
+// the coroutine lookups need C++20
+#if (__cplusplus >= 202002L) && defined(__cpp_impl_coroutine)
+#define SKIPLIST_HAS_COROUTINES 1
+#include <coroutine>
+#include <span>
+#include <optional>
+#include <utility>
+#endif
 
 // default value of the max skiplist's height
 #define DEFAULT_MAX_HEIGHT 32
 // control the probability of increasing skiplist-node's height
 // value is N, the has 1/N probability to increase height by one
 #define DEFAULT_PROBABILITY_DENOMINATOR 4
+// upper limit of the max skiplist's height,
+// the predecessor and successor arrays of a search are sized by it
+#define MAX_HEIGHT_LIMIT 64
+// default seed of the node height generator
+#define DEFAULT_HEIGHT_SEED 0x2545f4914f6cdd1dULL
+// the number of skiplists a thread keeps a height generator for
+#define HEIGHT_GENERATOR_CACHE_SIZE 4
+// the number of keys whose paths link_run looks up together,
+// with interleaved probes, once the runs it links are short
+#define LINK_RUN_WARM_WIDTH 16
 
-static std::default_random_engine generator;
-static std::uniform_int_distribution<int> distribution(0,INT32_MAX);
+// the number of skiplists a thread keeps a search finger for
+#define FINGER_CACHE_SIZE 4
+// how often a reader of the summaries retries before it waits for the writers
+#define SUMMARY_READ_RETRIES 8
+// the number of lookups read_batch interleaves
+#define READ_BATCH_WIDTH 8
+// the number of keys read_batch looks up interleaved, all of them going on
+// from the path to the last key of the ones before
+#define READ_BATCH_WINDOW 8
+// upper limit of the number of slots of the entry table of integer keys, as a power of 2
+#define ENTRY_TABLE_MAX_BITS 20
+// the number of slots after the one of its key an insert brings up to date at most
+#define ENTRY_TABLE_WRITER_SLOTS 4
+// upper limit of the number of nodes in the top level index
+#define TOP_INDEX_MAX_NODES (1 << 16)
+// how often the background thread looks whether the top level index is stale
+#define TOP_INDEX_INTERVAL_MS 100
+// the top level index is rebuilt once more than 1/N of its nodes changed
+#define TOP_INDEX_STALE_DENOMINATOR 8
+// the learned entry layer models about one node out of this many
+#define LEARNED_INDEX_SPACING 16
+// the most positions a segment of the learned entry layer may predict off
+#define LEARNED_INDEX_ERROR 8
+// the learned entry layer is retrained once more than 1/N of its nodes changed
+#define LEARNED_INDEX_RETRAIN_DENOMINATOR 8
+// how often the background thread looks whether the learned entry layer is stale
+#define LEARNED_INDEX_INTERVAL_MS 100
 
-template<class Key, class Value>
+// Reclaimer decides when erased nodes and replaced values are freed,
+// see Reclaimers.hpp
+// Augment decides what summary the towers keep, see Augmentations.hpp
+// Compare orders the keys, if it is transparent like the default std::less<>,
+// read, erase and Iterator::seek also take any type it compares with Key,
+// e.g. std::string_view or const char* for std::string keys,
+// with std::string keys and std::less the nodes cache a prefix of their key,
+// see KeyPrefix.hpp, with integer keys, std::less and NoReclamation,
+// point lookups start from an entry table, see EntryTable,
+// or from a learned model of the keys, see set_entry_layer,
+// and with NoReclamation a background thread may keep a sorted array
+// of the top levels for them, see start_top_index, and searches may start
+// from where the last one of the thread ended, see set_finger_search
+template<class Key, class Value, class Reclaimer = NoReclamation,
+         class Augment = NoAugmentation, class Compare = std::less<>>
 class Skiplist {
 private:
-    class Node {
+    typedef typename Reclaimer::Guard Guard;
+    typedef typename Augment::Summary Summary;
+    typedef KeyPrefix<Key, Compare> Prefix;
+    typedef IntegerKey<Key, Compare> EntryKey;
+    // the entry table may point to any node, so it is only kept
+    // while nodes are never freed before the list
+    static constexpr bool kEntryTable = EntryKey::kEnabled && !Reclaimer::kReclaimsEarly;
+
+    // values are immutable once published, an update swaps in a new cell
+    // so that readers never copy a value while a writer assigns it,
+    // the old cell is retired like an erased node, so with NoReclamation
+    // memory grows with the updates too
+    struct ValueCell : public Reclaimable {
+        Value value;
+        template<class... Args>
+        explicit ValueCell(Args&&... args): value(std::forward<Args>(args)...) {
+            reclaim = &ValueCell::destroy;
+        }
+        static void destroy(Reclaimable* r) { delete static_cast<ValueCell*>(r); }
+    };
+
+    // a node is allocated as one block: the node itself,
+    // followed by the rest of its tower and the cell of its first value,
+    // so the key and the lowest levels share a cache line,
+    // when the key has a cached prefix it sits right before the key
+    class Node : public Reclaimable, public NodePrefix<Prefix::kEnabled> {
     public:
         const Key key;
         int height;
+        // the number of levels this node is linked on, plus one while its
+        // inserter is still linking, the node is retired when it drops to 0
+        std::atomic<int> refs;
     public:
-        Value value() { return _value; }
-        void set_value(const Value& v) { _value = v; }
+        // the current value cell, load it through Guard::protect
+        const std::atomic<ValueCell*>& value_cell() { return _value; }
+        // replace the value cell, return the old one which may still be read,
+        // the first cell lives inside the node, it is only destroyed with it
+        ValueCell* exchange_value(ValueCell* cell) {
+            ValueCell* old = _value.exchange(cell, std::memory_order_acq_rel);
+            return old == inline_value() ? nullptr : old;
+        }
+        // the raw link, its low bit is set once this node is erased on that level,
+        // see is_marked/unmarked
         Node* next(int level) {
             assert((level >= 0) && (level < height));
             return _next[level].load(std::memory_order_acquire);
         }
+        // the link itself, a search loads it through Guard::protect
+        const std::atomic<Node*>& link(int level) {
+            assert((level >= 0) && (level < height));
+            return _next[level];
+        }
         void set_next(int level, Node* node) {
             assert((level >= 0) && (level < height));
             _next[level].store(node, std::memory_order_release);
         }
+        // link node at level only if the level still points to expected,
+        // a marked link never equals an unmarked expected, so it is frozen
+        bool cas_next(int level, Node* expected, Node* node) {
+            assert((level >= 0) && (level < height));
+            return _next[level].compare_exchange_strong(expected, node,
+                                                        std::memory_order_acq_rel,
+                                                        std::memory_order_acquire);
+        }
+        // set the mark bit of the link at level,
+        // return false if it was already marked by someone else
+        bool mark_next(int level) {
+            assert((level >= 0) && (level < height));
+            Node* n = _next[level].load(std::memory_order_acquire);
+            while (!is_marked(n)) {
+                if (_next[level].compare_exchange_weak(n, marked(n),
+                                                       std::memory_order_acq_rel,
+                                                       std::memory_order_acquire)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        // hint the cache to load what a search reads of n on level,
+        // n may be freed already, a prefetch never faults
+        static void prefetch(Node* n, int level) {
+            __builtin_prefetch(n);
+            __builtin_prefetch(&n->_next[level]);
+        }
+        // a node is logically erased once its level 0 link is marked
+        bool is_erased() { return is_marked(next(0)); }
+        // the summary of the span ending at this node on level,
+        // only kept when the augmentation is enabled
+        Summary summary(int level) {
+            assert(Augment::kEnabled && (level >= 0) && (level < height));
+            return summaries()[level].load(std::memory_order_relaxed);
+        }
+        void set_summary(int level, const Summary& s) {
+            assert(Augment::kEnabled && (level >= 0) && (level < height));
+            summaries()[level].store(s, std::memory_order_relaxed);
+        }
     private:
-        Value _value;
-        std::atomic<Node*>* _next;
-    public:
-        Node(const Key& k, const Value& v, int h): key(k), _value(v), height(h) {
-            _next = (std::atomic<Node*>*)malloc(height * sizeof(std::atomic<Node*>));
-            memset(_next, 0, height * sizeof(std::atomic<Node*>));
+        std::atomic<ValueCell*> _value;
+        // array of length equal to the node height, _next[0] is the lowest level,
+        // the levels above 0 follow the node in its block
+        std::atomic<Node*> _next[1];
+    private:
+        // the summaries follow the tower, the cell of the first value follows them
+        static size_t summary_offset(int h) {
+            size_t end = sizeof(Node) + (h - 1) * sizeof(std::atomic<Node*>);
+            return (end + alignof(std::atomic<Summary>) - 1) & ~(alignof(std::atomic<Summary>) - 1);
+        }
+        static size_t value_offset(int h) {
+            size_t end = summary_offset(h) + (Augment::kEnabled ? h : 0) * sizeof(std::atomic<Summary>);
+            return (end + alignof(ValueCell) - 1) & ~(alignof(ValueCell) - 1);
+        }
+        std::atomic<Summary>* summaries() {
+            return reinterpret_cast<std::atomic<Summary>*>(reinterpret_cast<char*>(this) + summary_offset(height));
+        }
+        ValueCell* inline_value() {
+            return reinterpret_cast<ValueCell*>(reinterpret_cast<char*>(this) + value_offset(height));
+        }
+        template<class K, class... Args>
+        Node(K&& k, int h, Args&&... args): NodePrefix<Prefix::kEnabled>(Prefix::of(k)),
+                                            key(std::forward<K>(k)), height(h), refs(2) {
+            for (int i = 0; i < height; i++) {
+                new (&_next[i]) std::atomic<Node*>(nullptr);
+            }
+            _value.store(new (inline_value()) ValueCell(std::forward<Args>(args)...),
+                         std::memory_order_relaxed);
+            if (Augment::kEnabled) {
+                // the upper spans are computed once the node is linked
+                new (&summaries()[0]) std::atomic<Summary>(Augment::of(key, inline_value()->value));
+                for (int i = 1; i < height; i++) {
+                    new (&summaries()[i]) std::atomic<Summary>(Augment::identity());
+                }
+            }
+            reclaim = Reclaimer::kReclaimsEarly ? &Node::destroy_and_free : &Node::destroy;
+        };
+        ~Node() {
+            ValueCell* cell = _value.load(std::memory_order_relaxed);
+            if (cell != inline_value()) {
+                delete cell;
+            }
+            inline_value()->~ValueCell();
         };
-        ~Node() {};
+    public:
+        // the size of the block of a node of height h
+        static size_t size_of(int h) { return value_offset(h) + sizeof(ValueCell); }
+        // the part read by a search: up to the second level of the tower
+        static size_t hot_size_of(int h) {
+            return sizeof(Node) + (std::min(h, 2) - 1) * sizeof(std::atomic<Node*>);
+        }
+        template<class K, class... Args>
+        static Node* create(void* mem, K&& k, int h, Args&&... args) {
+            return new (mem) Node(std::forward<K>(k), h, std::forward<Args>(args)...);
+        }
+        // the value of a node that was never published, it may be moved from
+        Value& unpublished_value() { return inline_value()->value; }
+        // the block of a node belongs to the arena unless the reclaimer frees early,
+        // then it comes from operator new
+        static void destroy(Reclaimable* r) { static_cast<Node*>(r)->~Node(); }
+        static void destroy_and_free(Reclaimable* r) {
+            destroy(r);
+            ::operator delete(static_cast<Node*>(r));
+        }
+    };
+    // direct-mapped entry points into a list of integer keys:
+    // with the keys mapped to uint64_t by EntryKey, bucket i holds the keys
+    // in [base + (i << shift), base + ((i + 1) << shift)), and slot i a node
+    // before them, close to them and tall, from which a lookup of such a key
+    // starts instead of the head,
+    // the slots are only hints: they are filled by the lookups, and an insert
+    // moves those of the next buckets up to the new node once it is linked,
+    // an erased one makes the lookup start over from the head,
+    // tables come from the arena, a replaced one is left there
+    struct EntryTable {
+        uint64_t base;
+        int shift;
+        int bits;
+        std::atomic<Node*> slots[1];
+
+        bool covers(uint64_t u) const {
+            return (u >= base) && (((u - base) >> shift) < (uint64_t(1) << bits));
+        }
+        size_t bucket(uint64_t u) const { return (u - base) >> shift; }
+        uint64_t bucket_start(size_t b) const { return base + (uint64_t(b) << shift); }
+        static EntryTable* create(Arena& arena, uint64_t base, int shift, int bits) {
+            size_t n = size_t(1) << bits;
+            void* mem = arena.allocate(sizeof(EntryTable) + (n - 1) * sizeof(std::atomic<Node*>),
+                                       alignof(EntryTable));
+            EntryTable* t = new (mem) EntryTable();
+            t->base = base;
+            t->shift = shift;
+            t->bits = bits;
+            for (size_t i = 1; i < n; i++) {
+                new (&t->slots[i]) std::atomic<Node*>();
+            }
+            for (size_t i = 0; i < n; i++) {
+                t->slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+            return t;
+        }
+    };
+    // a snapshot of the nodes of one level, those tall enough to reach it,
+    // in key order: a point lookup binary searches the keys and goes on down
+    // from that level of the last node before its key instead of walking
+    // the sparse top levels from the head, nodes erased since the snapshot
+    // make it start over from the head, the ones inserted are just missed
+    struct TopIndex : public Reclaimable {
+        int level;
+        std::vector<Key> keys;
+        std::vector<Node*> nodes;
+
+        TopIndex() : level(0) { reclaim = &TopIndex::destroy; }
+        static void destroy(Reclaimable* r) { delete static_cast<TopIndex*>(r); }
+    };
+    // a piecewise-linear model of where integer keys fall among the nodes
+    // of one level: a segment predicts that a key u is at about
+    // start + slope * (u - first) in the sorted modeled keys,
+    // at most LEARNED_INDEX_ERROR positions off for the modeled ones
+    struct LearnedSegment {
+        uint64_t first;
+        size_t start;
+        double slope;
+    };
+    // the learned entry layer, trained in the background over the nodes of
+    // a level, tall enough to be about one node out of LEARNED_INDEX_SPACING,
+    // a point lookup takes the last node before its key in a window around
+    // the prediction and goes on down from that level, like TopIndex
+    struct LearnedIndex : public Reclaimable {
+        int level;
+        std::vector<uint64_t> keys;
+        std::vector<Node*> nodes;
+        std::vector<LearnedSegment> segments;
+
+        LearnedIndex() : level(0) { reclaim = &LearnedIndex::destroy; }
+        static void destroy(Reclaimable* r) { delete static_cast<LearnedIndex*>(r); }
+    };
+    // a thread running a task every interval until it is stopped,
+    // it is woken up early to stop
+    class PeriodicTask {
+    public:
+        PeriodicTask() : _stop(false) {}
+        ~PeriodicTask() { stop(); }
+        void start(std::chrono::milliseconds interval, std::function<void()> task) {
+            stop();
+            _stop = false;
+            _thread = std::thread([this, interval, task]() {
+                std::unique_lock<std::mutex> lock(_lock);
+                while (!_wake.wait_for(lock, interval, [this]() { return _stop; })) {
+                    lock.unlock();
+                    task();
+                    lock.lock();
+                }
+            });
+        }
+        void stop() {
+            if (!_thread.joinable()) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                _stop = true;
+            }
+            _wake.notify_all();
+            _thread.join();
+        }
+    private:
+        std::thread _thread;
+        std::mutex _lock;
+        std::condition_variable _wake;
+        bool _stop;
+    };
+    // nodes are at least pointer aligned, so the low bit of a link is free
+    // to mark that the node owning the link is being erased
+    static bool is_marked(Node* p) {
+        return (reinterpret_cast<uintptr_t>(p) & 1) != 0;
+    }
+    static Node* marked(Node* p) {
+        return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(p) | 1);
+    }
+    static Node* unmarked(Node* p) {
+        return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(1));
+    }
+public:
+    // where point lookups of integer keys start
+    enum EntryLayer {
+        // at the head
+        NO_ENTRY_LAYER,
+        // at the hint of the entry table, the default
+        ENTRY_TABLE_LAYER,
+        // experimental: at the node a piecewise-linear model of the keys
+        // predicts, a background thread retrains it as the list changes,
+        // suited to smoothly distributed, mostly appended keys
+        LEARNED_LAYER
     };
 public:
     // insert a new key value pair, if the key exists, change the value
-    // or new a new node and insert
+    // or new a new node and insert, a change allocates a new value cell,
+    // with NoReclamation the old one is only freed with the list
     void insert(const Key& key, const Value& value);
+    void insert(Key&& key, Value&& value);
+    // like insert, but the value is constructed in place from args
+    template<class... Args>
+    void emplace(Key key, Args&&... args);
     // erase a key value pair, if the key does not exist, return false
-    bool erase(const Key& key);
+    bool erase(const Key& key) { return erase_as(key); }
+    template<class K, class C = Compare, class = typename C::is_transparent>
+    bool erase(const K& key) { return erase_as(key); }
     // read value according to key, if the key does not exist, return false
-    bool read(const Key& key, Value& value);
+    bool read(const Key& key, Value& value) { return read_as(key, value); }
+    template<class K, class C = Compare, class = typename C::is_transparent>
+    bool read(const K& key, Value& value) { return read_as(key, value); }
+    // insert the pairs of batch[0, n), the later value of a repeated key wins,
+    // the pairs are sorted by key and linked in one sweep through
+    // a SortedBuilder, each search going on from the predecessors the one
+    // before found, readers see the pairs falling between the same two keys
+    // of the list at once, and those groups in ascending key order
+    void insert_batch(const std::pair<Key, Value>* batch, size_t n);
+    // read the values of keys[0, n), found[i] tells whether keys[i] exists,
+    // values[i] is left as it is if not, return the number of keys found,
+    // the keys are sorted and looked up in one ascending pass, by windows
+    // of READ_BATCH_WINDOW keys, each lookup going on from the path to
+    // the last key of the window before instead of from the head,
+    // up to READ_BATCH_WIDTH lookups of a window run interleaved, each one
+    // prefetches the node it steps to next and hands over to the others
+    // meanwhile, so that their cache misses overlap
+    size_t read_batch(const Key* keys, size_t n, Value* values, bool* found);
+#ifdef SKIPLIST_HAS_COROUTINES
+    // the same with coroutines: each of up to width lookups in flight
+    // is a coroutine suspending after every step of its search,
+    // values[i] is left empty if keys[i] does not exist
+    size_t read_batch_coroutines(std::span<const Key> keys,
+                                 std::span<std::optional<Value>> values,
+                                 int width = READ_BATCH_WIDTH);
+#endif
+    // keep a sorted array of the nodes on the top levels for point lookups,
+    // a background thread looks every interval whether the list changed
+    // enough since the last snapshot and takes a new one then,
+    // readers pick it up through an atomic pointer, writes are unchanged,
+    // only for lists that never free nodes early, replaced arrays are
+    // freed once no lookup can hold them any more
+    void start_top_index(std::chrono::milliseconds interval =
+                         std::chrono::milliseconds(TOP_INDEX_INTERVAL_MS));
+    // stop the background thread, the last snapshot is still used
+    void stop_top_index();
+    // take a new snapshot now if the list changed since the last one
+    void rebuild_top_index() { refresh_top_index(0); }
+    // choose where point lookups start, only lists of integer keys
+    // with NoReclamation have entry layers, the others ignore it,
+    // the learned one is trained now and then kept up to date by
+    // a background thread, not to be called concurrently with itself
+    void set_entry_layer(EntryLayer layer);
+    // let every thread start its searches from its finger, the predecessors
+    // its last search met, so that a search near the last one costs about
+    // log of the distance instead of log of the size, only for lists that
+    // never free nodes early and keep no summaries: the finger is kept
+    // between operations, its nodes are checked on the way, an erased one
+    // makes the search start over from the head
+    void set_finger_search(bool on) {
+        static_assert(!Reclaimer::kReclaimsEarly && !Augment::kEnabled,
+                      "finger search needs nodes that are never freed early and no summaries");
+        _finger_search.store(on, std::memory_order_relaxed);
+    }
+    // read the pair with the greatest key <= key, return false if there is none
+    bool floor(const Key& key, Key& found, Value& value) {
+        return read_last_before([this, &key](Node* n) { return !less(key, n->key); }, found, value);
+    }
+    // read the pair with the smallest key >= key, return false if there is none
+    bool lower_bound(const Key& key, Key& found, Value& value);
+    // read the pair with the smallest key > key, return false if there is none
+    bool upper_bound(const Key& key, Key& found, Value& value);
+    // read the pair with the greatest key, return false if the list is empty
+    bool find_last(Key& found, Value& value) {
+        return read_last_before([](Node* n) { return true; }, found, value);
+    }
     // dump the skiplist to file
     bool dump_to(const std::string& path);
-    // recover the skiplist from a pre-dumped file
+    // recover the skiplist from a pre-dumped file,
+    // the dump is sorted, so it is loaded through a SortedBuilder
     bool load_from(const std::string& path);
+    // insert the pairs of [begin, end), in ascending key order,
+    // through a SortedBuilder, see there
+    template<class It>
+    void bulk_load(It begin, It end);
+    // the number of keys < key,
+    // rank, select and count_range need an augmentation with span widths,
+    // such as IndexAugmentation, like aggregate they read the summaries
+    // between two writes, see read_summaries
+    size_t rank(const Key& key);
+    // read the pair with the k-th smallest key, counted from 0,
+    // return false if there are not more than k keys
+    bool select(size_t k, Key& found, Value& value);
+    // the number of keys in [lo, hi)
+    size_t count_range(const Key& lo, const Key& hi);
+    // fold the values of the keys in [lo, hi],
+    // it needs an AggregateAugmentation and joins the summaries
+    // of the widest spans inside the range, in O(log n)
+    Summary aggregate(const Key& lo, const Key& hi);
+    // restart the node height generators from seed,
+    // a single writer then builds the same shape on every run,
+    // call it while no insert is running
+    void seed_height_generator(uint64_t seed);
+    // call cb(key, value) for the keys in [begin, end) in ascending order,
+    // at most limit of them, return how many were visited,
+    // it runs one search for begin and then walks level 0
+    template<class Callback>
+    size_t scan(const Key& begin, const Key& end, size_t limit, Callback cb);
+
+    // build the nodes of pairs given in ascending key order ahead of the list:
+    // add only makes the nodes, publish builds their towers left to right
+    // and links them in with one compare-and-swap per level for each gap
+    // between the keys of the list they fall into, so loading n pairs into
+    // an empty list, or behind its last key, takes O(n) and no search per key,
+    // and readers see all of them at once, when level 0 is linked,
+    // keys interleaved with the ones of the list only cost a search per gap,
+    // a key that is not greater than the one added before publishes
+    // the pairs added so far first, pairs never published are dropped
+    class SortedBuilder {
+    public:
+        explicit SortedBuilder(Skiplist* list) : _list(list), _height(0) {}
+        SortedBuilder(const SortedBuilder&) = delete;
+        SortedBuilder& operator=(const SortedBuilder&) = delete;
+        ~SortedBuilder() {
+            for (Node* n : _nodes) {
+                _list->discard_node(n);
+            }
+        }
+        // make room for n more pairs
+        void reserve(size_t n) { _nodes.reserve(_nodes.size() + n); }
+        // add a pair after the ones added before, with a node of height,
+        // or a random height if it is 0, the later value of a repeated key wins
+        void add(Key key, Value value, int height = 0);
+        // link the pairs added so far into the list
+        void publish();
+        // the number of pairs added and not published yet
+        size_t size() const { return _nodes.size(); }
+    private:
+        Skiplist* _list;
+        std::vector<Node*> _nodes;
+        // the towers are built as the nodes are added:
+        // the first and the last node of each level below _height
+        Node* _firsts[MAX_HEIGHT_LIMIT];
+        Node* _lasts[MAX_HEIGHT_LIMIT];
+        int _height;
+    };
+
+    // iterate over the skiplist in ascending key order,
+    // it is safe next to concurrent writers: it sees every key that stays
+    // in the list during the iteration, and keys inserted or erased meanwhile
+    // may or may not show up,
+    // the iterator holds a guard, under EpochReclamation nothing retired
+    // while it is alive can be freed, so don't keep it around
+    class Iterator {
+    public:
+        explicit Iterator(Skiplist* list) : _list(list), _guard(list->_reclaimer), _node(nullptr) {}
+        Iterator(const Iterator&) = delete;
+        Iterator& operator=(const Iterator&) = delete;
+        // true if the iterator is positioned at a node
+        bool valid() const { return _node != nullptr; }
+        // the key of the current node, requires valid()
+        const Key& key() const {
+            assert(valid());
+            return _node->key;
+        }
+        // a copy of the current value of the node, requires valid()
+        Value value() {
+            assert(valid());
+            return _list->read_value(_guard, _node);
+        }
+        // advance to the next key, requires valid()
+        void next() {
+            assert(valid());
+            set(_list->next_node(_guard, _node));
+        }
+        // position at the first key >= key
+        void seek(const Key& key) { seek_as(key); }
+        template<class K, class C = Compare, class = typename C::is_transparent>
+        void seek(const K& key) { seek_as(key); }
+        // position at the first key of the list
+        void seek_to_first() {
+            set(_list->next_node(_guard, _list->_head));
+        }
+    private:
+        Skiplist* _list;
+        Guard _guard;
+        // kept in TRAIL_SLOT of the guard
+        Node* _node;
+        void set(Node* n) {
+            _node = n;
+            _guard.set(_list->scratch_slot(TRAIL_SLOT), n);
+        }
+        template<class K>
+        void seek_as(const K& key) {
+            set(_list->find_greater_or_equal(_guard, key, nullptr));
+        }
+    };
+
+    // iterate over the skiplist in descending key order,
+    // nodes only link forward, so it copies the pairs before the current
+    // position into a buffer: it searches a predecessor on an upper level
+    // and walks level 0 from there, each refill starts one level higher,
+    // so reading the last N pairs costs O(log n + N) amortized,
+    // key and value are the copies, concurrent writers are seen as by Iterator
+    class ReverseIterator {
+    public:
+        explicit ReverseIterator(Skiplist* list) : _list(list), _guard(list->_reclaimer),
+                                                   _level(0), _done(true) {}
+        ReverseIterator(const ReverseIterator&) = delete;
+        ReverseIterator& operator=(const ReverseIterator&) = delete;
+        // true if the iterator is positioned at a pair
+        bool valid() const { return !_buffer.empty(); }
+        // the current pair, requires valid()
+        const Key& key() const {
+            assert(valid());
+            return _buffer.back().first;
+        }
+        const Value& value() const {
+            assert(valid());
+            return _buffer.back().second;
+        }
+        // move to the next smaller key, requires valid()
+        void next() {
+            assert(valid());
+            _buffer.pop_back();
+            if (_buffer.empty() && !_done) {
+                fill(_bound, false);
+            }
+        }
+        // position at the greatest key <= key
+        void seek_for_prev(const Key& key) {
+            _level = 0;
+            fill(key, true);
+        }
+        // position at the greatest key of the list
+        void seek_to_last() {
+            _level = 0;
+            fill(Key(), true, true);
+        }
+    private:
+        // the level of the first refill after a seek and the highest one,
+        // up to about _pd^MAX_LEVEL pairs are buffered
+        static const int MAX_LEVEL = 6;
+        Skiplist* _list;
+        Guard _guard;
+        // pairs before the position in ascending order, the current one last
+        std::vector<std::pair<Key, Value>> _buffer;
+        // the pairs still to buffer are the ones before _bound
+        Key _bound;
+        int _level;
+        // no pair is left before _bound
+        bool _done;
+        // buffer the pairs before bound, or up to it if inclusive, or all
+        void fill(const Key& bound, bool inclusive, bool unbounded = false);
+    };
 private:
     // the upper bound of this skiplist's height
     int _max_h;
     // increase node's height with probability (1/_pd)
     int _pd;
-    // record all nodes generated by this skiplist
-    // only when this skiplist is destroyed these nodes will be freed
-    // erase a node only take it away from skiplist, but won't free it
-    std::vector<Node*> _all_nodes;
+    // log2(_pd) if _pd is a power of two, otherwise 0
+    int _pd_shift;
+    // identifies this skiplist in the height generator cache of a thread
+    const uint64_t _id;
+    // the seed of the height generators and how many times it was set,
+    // a thread restarts its generator when the generation changed
+    std::atomic<uint64_t> _height_seed;
+    std::atomic<uint64_t> _height_seed_generation;
+    // the number of generators started from the current seed,
+    // each thread draws from its own stream
+    std::atomic<uint64_t> _height_streams;
+    // nodes are bump allocated from it unless the reclaimer frees them early,
+    // declared before the reclaimer, so it outlives the nodes retired to it
+    Arena _arena;
+    // erased nodes and replaced values are retired to it,
+    // it frees them once no reader can reach them any more
+    Reclaimer _reclaimer;
+    // replaced top level indexes and learned models are retired to it,
+    // a lookup taking one pins it meanwhile, unlike the nodes
+    // they are freed soon whatever the reclaimer of the list
+    EpochReclamation _snapshots;
+    // taken by writers when the augmentation is enabled
+    std::mutex _write_lock;
+    // incremented when such a write starts and when it ends,
+    // so it is odd while the summaries may be half updated
+    std::atomic<uint64_t> _write_seq;
     // the skiplist's current height, there may write and read concurrent,
     // so it needs to be atomic
     std::atomic<int> _cur_h;
     // dummy head node of skiplist
     Node* _head;
+    // the entry table, only kept with kEntryTable, replaced as the list grows
+    std::atomic<EntryTable*> _entries;
+    // the top level index, nullptr until it is first built
+    std::atomic<TopIndex*> _top_index;
+    // the background thread rebuilding it
+    PeriodicTask _indexer;
+    // the last node of each level, as far as the inserters know,
+    // maybe erased or followed by a node linked since, cleared before
+    // a node is retired if the reclaimer frees nodes early
+    std::atomic<Node*> _tails[MAX_HEIGHT_LIMIT];
+    // whether searches start from the finger of their thread
+    std::atomic<bool> _finger_search;
+    // the entry layer lookups of integer keys use, an EntryLayer
+    std::atomic<int> _entry_layer;
+    // the learned entry layer, nullptr until it is first trained,
+    // the writers count the changes to the modeled nodes, and the background
+    // thread retrains it once they made it stale, one training at a time
+    std::atomic<LearnedIndex*> _learned;
+    std::atomic<size_t> _learned_changes;
+    std::mutex _learned_lock;
+    PeriodicTask _trainer;
+    // orders the keys
+    Compare _compare;
     // the serializer
     ISerializer<Key, Value>* _serializer;
 private:
+    // guard slots after the ones recording the predecessors and successors
+    // of a search, they hold the nodes the search itself steps through
+    enum {
+        PRED_SLOT = 0,
+        CURR_SLOT,
+        SUCC_SLOT,
+        // the value cell being copied
+        VALUE_SLOT,
+        // the node a level 0 walk continues from, see next_node
+        TRAIL_SLOT,
+        SCRATCH_SLOT_NUM
+    };
+    int pred_slot(int level) { return level; }
+    int succ_slot(int level) { return _max_h + level; }
+    int scratch_slot(int which) { return 2 * _max_h + which; }
+    // the PRED_SLOT, CURR_SLOT and SUCC_SLOT of the i-th lookup of read_batch
+    int batch_slot(int i, int which) { return 2 * _max_h + SCRATCH_SLOT_NUM + 3 * i + which; }
+    // the wyrand generator a thread draws node heights from, one per skiplist
+    struct HeightGenerator {
+        uint64_t owner;
+        uint64_t generation;
+        uint64_t state;
+    };
+    // the predecessors the last search of a thread met on each level,
+    // or the head, all of them stay valid as nodes are never freed early
+    struct Finger {
+        uint64_t owner;
+        Node* preds[MAX_HEIGHT_LIMIT];
+    };
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> id(0);
+        return id.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    // the generator of the calling thread for this skiplist
+    HeightGenerator& height_generator();
     // generate random height,
     // return 1 for probability of (1 - 1/_pd),
     // 2 for (1/_pd) * (1 - 1/_pd), 3 for (1/_pd)^2 * (1 - 1/_pd),.. and so on
     int random_height();
-    // generate a new node for skiplist and record it
-    Node* new_node(const Key& k, const Value& v, int height);
+    // generate a new node for skiplist
+    template<class K, class... Args>
+    Node* new_node(K&& k, int height, Args&&... args);
+    // free a node that was never linked
+    void discard_node(Node* n) { n->reclaim(n); }
+    // drop one reference of a node, retire it when it is unlinked everywhere
+    void release_node(Guard& guard, Node* n);
+    // where the search of an insert of key may start, from the last nodes of
+    // the levels: if every one of them is before key, the new node is
+    // appended after them without a search, preds and succs are filled
+    // and level is -1, otherwise the search starts on level of the node
+    // returned, the last node of the lowest level still before key,
+    // with the levels above filled, nullptr if there is none,
+    // the levels are filled up to height even if the list got lower meanwhile
+    template<class K>
+    Node* tail_finger(Guard& guard, const K& key, int height, Node** preds, Node** succs, int& level);
+    // swap a new value, constructed from args, into an existing node
+    template<class... Args>
+    void update_value(Guard& guard, Node* n, Args&&... args);
+    // copy the current value of a node
+    Value read_value(Guard& guard, Node* n) {
+        return guard.protect(scratch_slot(VALUE_SLOT), n->value_cell())->value;
+    }
+    // a < b and a equivalent to b in the order of Compare
+    template<class A, class B>
+    bool less(const A& a, const B& b) { return _compare(a, b); }
+    template<class A, class B>
+    bool equal(const A& a, const B& b) { return !_compare(a, b) && !_compare(b, a); }
+    // the same with a node on one side, kp is Prefix::of(key),
+    // when the cached prefixes differ they decide without reading the keys
+    template<class K>
+    bool less(Node* n, const K& key, uint64_t kp) {
+        if (Prefix::kEnabled && (n->key_prefix() != kp)) {
+            return n->key_prefix() < kp;
+        }
+        return less(n->key, key);
+    }
+    template<class K>
+    bool less(const K& key, uint64_t kp, Node* n) {
+        if (Prefix::kEnabled && (n->key_prefix() != kp)) {
+            return kp < n->key_prefix();
+        }
+        return less(key, n->key);
+    }
+    template<class K>
+    bool equal(Node* n, const K& key) {
+        if (Prefix::kEnabled && (n->key_prefix() != Prefix::of(key))) {
+            return false;
+        }
+        return equal(n->key, key);
+    }
+    template<class K>
+    bool read_as(const K& key, Value& value);
+    template<class K>
+    bool erase_as(const K& key);
+    // find_position steps from a node to next on level while
+    // walker.before(next, level) is true, and calls walker.restart()
+    // whenever the search starts over from the head
+    template<class F>
+    struct KeyWalker {
+        F before_node;
+        bool before(Node* n, int level) { return before_node(n); }
+        void restart() {}
+    };
+    // a walker that only looks at the node
+    template<class F>
+    static KeyWalker<F> by_node(F f) { return KeyWalker<F>{f}; }
+    // a walker that counts the nodes it steps over on level 0
+    template<class F>
+    struct CountingWalker {
+        F before_node;
+        size_t steps;
+        bool before(Node* n, int level) {
+            if (!before_node(n, steps + Augment::width(n->summary(level)))) {
+                return false;
+            }
+            steps += Augment::width(n->summary(level));
+            return true;
+        }
+        void restart() { steps = 0; }
+    };
+    // a walker that steps on while before_node(node, its rank from 1) is true
+    template<class F>
+    static CountingWalker<F> counting(F f) { return CountingWalker<F>{f, 0}; }
+    // writers hold it while the augmentation is enabled
+    class WriteLock {
+    public:
+        explicit WriteLock(Skiplist& list) : _list(list) {
+            if (Augment::kEnabled) {
+                _list._write_lock.lock();
+                _list._write_seq.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+        }
+        ~WriteLock() {
+            if (Augment::kEnabled) {
+                _list._write_seq.fetch_add(1, std::memory_order_release);
+                _list._write_lock.unlock();
+            }
+        }
+        WriteLock(const WriteLock&) = delete;
+        WriteLock& operator=(const WriteLock&) = delete;
+    private:
+        Skiplist& _list;
+    };
+    // run read, which reads summaries, until no write ran meanwhile,
+    // after SUMMARY_READ_RETRIES attempts it waits for the writers instead,
+    // so its result is the one of a single point between two writes
+    template<class Read>
+    auto read_summaries(Read read) -> decltype(read());
+    // the number of keys < key
+    size_t count_below(Guard& guard, const Key& key) {
+        uint64_t kp = Prefix::of(key);
+        auto walker = counting([this, &key, kp](Node* n, size_t r) { return less(n, key, kp); });
+        find_position(guard, walker, nullptr, nullptr);
+        return walker.steps;
+    }
+    // fold the values of the keys in [lo, hi]
+    Summary fold(Guard& guard, const Key& lo, const Key& hi);
+    // recompute the summaries of the spans that cover key on the levels above 0,
+    // preds[l] is the last node before key on level l,
+    // on each level the spans up to the first node after key are recomputed,
+    // from the bottom up, as each span joins the spans of the level below
+    void refresh_summaries(Node** preds, const Key& key);
     // find a node whose key value greater or equal to input param key
-    // if such node does not exist, return the last node
+    // if such node does not exist, return nullptr
     // if the input param vec is not null,
-    // it will record the last traverse node on each level during the find process
-    Node* find_greater_or_equal(const Key& key,
-                                std::vector<Node*>* vec);
+    // it will record the last traverse node on each level during the find process,
+    // and if succs is not null, the node following it on that level
+    // the search starts at least at level (height - 1),
+    // erased nodes met on the way are unlinked before going on
+    // every node it returns or records stays protected in the guard
+    // until the next search with the same guard
+    // a search may also be given where to start, see find_position
+    template<class K>
+    Node* find_greater_or_equal(Guard& guard,
+                                const K& key,
+                                Node** vec,
+                                Node** succs = nullptr,
+                                int height = 1,
+                                Node* start = nullptr,
+                                int start_level = 0) {
+        uint64_t kp = Prefix::of(key);
+        // a search that records nothing may start at an entry point,
+        // else at the finger of the thread or at a node of the top level index
+        if constexpr (!Reclaimer::kReclaimsEarly) {
+            if constexpr (kEntryTable && std::is_same<K, Key>::value) {
+                if (!start && !vec && !succs && (height == 1)) {
+                    int layer = _entry_layer.load(std::memory_order_relaxed);
+                    if (layer == ENTRY_TABLE_LAYER) {
+                        start = entry_point(guard, key);
+                        if (start && (start != _head)) {
+                            start_level = start->height - 1;
+                        }
+                    } else if (layer == LEARNED_LAYER) {
+                        start = learned_point(key, start_level);
+                    }
+                    if (start == _head) {
+                        start = nullptr;
+                    }
+                }
+            }
+        }
+        Finger* f = nullptr;
+        if constexpr (!Reclaimer::kReclaimsEarly && !Augment::kEnabled) {
+            if (_finger_search.load(std::memory_order_relaxed)) {
+                f = &finger();
+                if (!start) {
+                    start = finger_point(*f, key, kp, height, start_level);
+                }
+            }
+        }
+        if constexpr (!Reclaimer::kReclaimsEarly) {
+            if (!start && !vec && !succs && (height == 1)) {
+                start = top_index_point(key, start_level);
+            }
+        }
+        if (f) {
+            // the search records the finger, the levels it surely fills
+            // are copied there if it records them for the caller
+            int filled = (start && (start != _head)) ? start_level
+                                                     : std::max(get_current_list_height(), height) - 1;
+            Node* next = find_position(guard, by_node([this, &key, kp](Node* n) { return less(n, key, kp); }),
+                                       vec ? vec : f->preds, succs, height, start, start_level);
+            if (vec) {
+                std::copy(vec, vec + filled + 1, f->preds);
+            }
+            return next;
+        }
+        return find_position(guard, by_node([this, &key, kp](Node* n) { return less(n, key, kp); }),
+                             vec, succs, height, start, start_level);
+    }
+    // the node of the finger to start a search of key from, on level:
+    // the one of the lowest level, at least height - 1, that is before key
+    // and followed on it by a node that is not, nullptr if there is none
+    template<class K>
+    Node* finger_point(Finger& f, const K& key, uint64_t kp, int height, int& level) {
+        int top = get_current_list_height();
+        for (int l = height - 1; l < top; l++) {
+            Node* p = f.preds[l];
+            if (p == _head) {
+                return nullptr;
+            }
+            if (!less(p, key, kp)) {
+                continue;
+            }
+            Node* next = p->next(l);
+            if (is_marked(next) || (next && less(next, key, kp))) {
+                continue;
+            }
+            level = l;
+            return p;
+        }
+        return nullptr;
+    }
+    // the finger of the calling thread, it starts at the head
+    Finger& finger();
+    // the last node of the top level index before key and the level
+    // to go on from, nullptr if there is none
+    template<class K>
+    Node* top_index_point(const K& key, int& level) {
+        if (!_top_index.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        EpochReclamation::Guard pin(_snapshots);
+        TopIndex* index = _top_index.load(std::memory_order_acquire);
+        size_t lo = 0;
+        size_t hi = index->keys.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (less(index->keys[mid], key)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == 0) {
+            return nullptr;
+        }
+        level = index->level;
+        return index->nodes[lo - 1];
+    }
+    // take a new snapshot of the top levels if more than
+    // 1/stale_denominator of the nodes of the current one changed,
+    // or if any changed and stale_denominator is 0
+    void refresh_top_index(size_t stale_denominator);
+    // collect the nodes on level, give up once there are more than limit
+    bool collect_level(int level, size_t limit, std::vector<Key>* keys, std::vector<Node*>& nodes);
+    // a node before key to start its search from, or nullptr for the head,
+    // taken from the entry table, a missing slot is filled on the way
+    Node* entry_point(Guard& guard, const Key& key);
+    // make the entry table cover key, and give it more slots as the list grows
+    void cover_entry_key(Guard& guard, const Key& key);
+    // let the slots of up to ENTRY_TABLE_WRITER_SLOTS buckets after the one
+    // of n start from n if they start before it, n is linked on every level
+    void enter_entry_node(Node* n);
+    // the last node the learned entry layer has before key and the level
+    // to go on from, nullptr if key is not after its first one and up to its last one
+    Node* learned_point(const Key& key, int& level);
+    // the level the learned entry layer models
+    int learned_level() const {
+        int level = 0;
+        for (long spacing = 1; spacing < LEARNED_INDEX_SPACING; spacing *= _pd) {
+            level++;
+        }
+        return level;
+    }
+    // called by a writer that linked or erased n, count the change
+    // if n is tall enough to be modeled
+    void note_learned_change(Node* n) {
+        if (n->height > learned_level()) {
+            _learned_changes.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // retrain the learned entry layer if more than
+    // 1/LEARNED_INDEX_RETRAIN_DENOMINATOR of its nodes changed
+    void refresh_learned();
+    // train the learned entry layer from scratch, with _learned_lock held
+    void train_learned();
+    // find the last node on level the walker steps to,
+    // return nullptr if there is none, the node stays protected in the guard
+    template<class Walker>
+    Node* find_last_before(Guard& guard, Walker&& walker, int level = 0) {
+        Node* preds[MAX_HEIGHT_LIMIT];
+        find_position(guard, walker, preds, nullptr, level + 1);
+        return preds[level] == _head ? nullptr : preds[level];
+    }
+    template<class Before>
+    bool read_last_before(Before before, Key& found, Value& value) {
+        Guard guard(_reclaimer);
+        Node* n = find_last_before(guard, by_node(before));
+        if (n) {
+            found = n->key;
+            value = read_value(guard, n);
+            return true;
+        }
+        return false;
+    }
+    // find the first node whose key is greater than the input param key
+    Node* find_greater(Guard& guard, const Key& key) {
+        uint64_t kp = Prefix::of(key);
+        return find_position(guard, by_node([this, &key, kp](Node* n) { return !less(key, kp, n); }),
+                             nullptr, nullptr);
+    }
+    // the search behind the find functions,
+    // on each level it stops in front of the first node the walker rejects,
+    // it may start on start_level of start instead of the head, a node the
+    // walker steps to, linked on that level and protected in the guard,
+    // the caller records the levels above then
+    template<class Walker>
+    Node* find_position(Guard& guard,
+                        Walker&& walker,
+                        Node** vec,
+                        Node** succs,
+                        int height = 1,
+                        Node* start = nullptr,
+                        int start_level = 0);
+    // return the first node after p on level 0 that is not erased,
+    // p is the head or a node protected in TRAIL_SLOT,
+    // if p gets erased meanwhile, the walk continues from its key
+    Node* next_node(Guard& guard, Node* p);
+    // one lookup of read_batch, its nodes are kept in the guard at batch_slot(slot, ...)
+    struct Probe {
+        const Key* key;
+        uint64_t kp;
+        size_t index;
+        int slot;
+        Node* p;
+        int level;
+        // the first node >= key, once the lookup is done
+        Node* result;
+        // if not null, the predecessor of key on each level, once it is done
+        Node** path;
+    };
+    void start_probe(Probe& probe, const Key* key, size_t index, Node** path = nullptr) {
+        probe.key = key;
+        probe.kp = Prefix::of(*key);
+        probe.index = index;
+        probe.path = path;
+        restart_probe(probe);
+    }
+    void restart_probe(Probe& probe) {
+        probe.p = _head;
+        probe.level = get_current_list_height() - 1;
+        if (probe.path) {
+            std::fill(probe.path + probe.level + 1, probe.path + _max_h, _head);
+        }
+    }
+    // let the probe go on from where a search of its key would from preds,
+    // filled by a search of a key not greater, see resume_point
+    void resume_probe(Guard& guard, Probe& probe, Node** preds) {
+        int level = 0;
+        Node* start = resume_point(guard, preds, *probe.key, 1, level);
+        if (start) {
+            probe.p = start;
+            probe.level = level;
+            guard.set(batch_slot(probe.slot, PRED_SLOT), start);
+            if (probe.path) {
+                std::fill(probe.path + level + 1, probe.path + _max_h, _head);
+            }
+        }
+    }
+    // advance the lookup by one node, like find_position does,
+    // and prefetch the node the next step reads, return true once it is done
+    bool step_probe(Guard& guard, Probe& probe);
+    // look up *key_at(0), .. *key_at(n - 1) with up to READ_BATCH_WIDTH
+    // probes interleaved, done(probe) is called as each one finishes,
+    // if preds is not null, the probes go on from it, see resume_probe,
+    // if paths is not null, the path of *key_at(k) is left in paths[k * MAX_HEIGHT_LIMIT, ..)
+    template<class KeyAt, class Done>
+    void run_probes(Guard& guard, size_t n, KeyAt key_at, Done done,
+                    Node** preds = nullptr, Node** paths = nullptr);
+#ifdef SKIPLIST_HAS_COROUTINES
+    // a coroutine that is resumed by hand until it is done
+    class LookupTask {
+    public:
+        struct promise_type {
+            LookupTask get_return_object() {
+                return LookupTask(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+        explicit LookupTask(std::coroutine_handle<promise_type> h) : _handle(h) {}
+        LookupTask(LookupTask&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+        ~LookupTask() {
+            if (_handle) {
+                _handle.destroy();
+            }
+        }
+        LookupTask(const LookupTask&) = delete;
+        LookupTask& operator=(const LookupTask&) = delete;
+        bool done() const { return _handle.done(); }
+        void resume() { _handle.resume(); }
+    private:
+        std::coroutine_handle<promise_type> _handle;
+    };
+    // look up the keys from *next on, one at a time, with the guard slots of slot,
+    // suspend after every step of a search
+    LookupTask lookup_keys(Guard& guard,
+                           int slot,
+                           std::span<const Key> keys,
+                           std::span<std::optional<Value>> values,
+                           size_t* next,
+                           size_t* found_num);
+#endif
     // get current skiplist's height
     int get_current_list_height() {
         return _cur_h.load(std::memory_order_acquire);
@@ -102,121 +1168,521 @@ private:
     void set_current_list_height(int h) {
         _cur_h.store(h, std::memory_order_release);
     }
-    void _add(const Key& key, const Value& value, int height);
+    // drop the empty levels at the top of the list,
+    // the height is only where searches start: if it races with an inserter
+    // raising it, a few upper links stay unused until the height is raised again
+    void lower_current_list_height() {
+        int cur = get_current_list_height();
+        while ((cur > 1) && (unmarked(_head->next(cur - 1)) == nullptr)) {
+            if (_cur_h.compare_exchange_weak(cur, cur - 1, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+                cur--;
+            }
+        }
+    }
+    // raise current skiplist's height to at least h,
+    // concurrent writers may race, the highest one wins
+    void raise_current_list_height(int h) {
+        int cur = get_current_list_height();
+        while ((h > cur) &&
+               !_cur_h.compare_exchange_weak(cur, h, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {}
+    }
+    // insert key with a value constructed from args,
+    // both are only copied or moved into the node or the new value cell,
+    // K is Key itself, const or a reference
+    template<class K, class... Args>
+    void _add(Guard& guard, int height, K&& key, Args&&... args);
+    // link n on level once it is linked on the levels below, preds and succs
+    // are the ones of a search for its key that filled at least height levels,
+    // a failed attempt searches again, return false once n is erased
+    bool link_level(Guard& guard, Node* n, int level, int height, Node** preds, Node** succs);
+    // link the unpublished nodes[0, n), in ascending key order, into the list:
+    // the ones that fall into the same gap between the keys of the list
+    // are linked to each other first and then go in with one compare-and-swap
+    // per level, a key that is in the list already gets the new value,
+    // the nodes come linked to each other already, from firsts[l] to lasts[l]
+    // on the levels l below height, and with all their levels counted in refs
+    void link_run(Guard& guard, Node** nodes, size_t n, Node** firsts, Node** lasts, int height);
+    // where a search for key, greater than the one preds were filled for,
+    // goes on from: the predecessor of the lowest level, at least height - 1,
+    // that is followed on it by a node that is not before key,
+    // nullptr to start from the head
+    Node* resume_point(Guard& guard, Node** preds, const Key& key, int height, int& level) {
+        int top = get_current_list_height();
+        for (int l = height - 1; l < top; l++) {
+            Node* p = preds[l];
+            if (p == _head) {
+                return nullptr;
+            }
+            // p is still kept in its predecessor slot
+            Node* next = guard.protect(scratch_slot(CURR_SLOT), p->link(l));
+            if (is_marked(next) || (next && less(next->key, key))) {
+                continue;
+            }
+            level = l;
+            return p;
+        }
+        return nullptr;
+    }
 public:
     // to implement dump/load for skiplist
     // for template class type Key and Value
     // caller should implement ISerializer interface
     // to implement their corresponding serialized method
-    Skiplist(int max_height, int probability_denominator, ISerializer<Key, Value>* s);
-    Skiplist(ISerializer<Key, Value>* s = nullptr) : Skiplist(DEFAULT_MAX_HEIGHT,
-                                                              DEFAULT_PROBABILITY_DENOMINATOR,
-                                                              s) {}
+    Skiplist(int max_height, int probability_denominator, ISerializer<Key, Value>* s,
+             const Compare& compare = Compare());
+    Skiplist(ISerializer<Key, Value>* s = nullptr,
+             const Compare& compare = Compare()) : Skiplist(DEFAULT_MAX_HEIGHT,
+                                                            DEFAULT_PROBABILITY_DENOMINATOR,
+                                                            s, compare) {}
     ~Skiplist();
     Skiplist(const Skiplist&) = delete;
     Skiplist& operator=(const Skiplist&) = delete;
 };
 
-template<class Key, class Value>
-Skiplist<Key, Value>::Skiplist(int max_height,
-                               int probability_denominator,
-                               ISerializer<Key, Value>* s) :
-                               _max_h(max_height),
-                               _pd(probability_denominator),
-                               _cur_h(1),
-                               _serializer(s) {
-    _head = new_node(Key(), Value(), _max_h);
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::Skiplist(int max_height,
+                                                            int probability_denominator,
+                                                            ISerializer<Key, Value>* s,
+                                                            const Compare& compare) :
+                                                            _max_h(std::min(max_height, MAX_HEIGHT_LIMIT)),
+                                                            _pd(probability_denominator),
+                                                            _pd_shift(0),
+                                                            _id(next_id()),
+                                                            _height_seed(DEFAULT_HEIGHT_SEED),
+                                                            _height_seed_generation(0),
+                                                            _height_streams(0),
+                                                            _reclaimer(2 * max_height + SCRATCH_SLOT_NUM +
+                                                                       3 * READ_BATCH_WIDTH),
+                                                            _snapshots(0, 1),
+                                                            _write_seq(0),
+                                                            _cur_h(1),
+                                                            _entries(nullptr),
+                                                            _top_index(nullptr),
+                                                            _finger_search(false),
+                                                            _entry_layer(ENTRY_TABLE_LAYER),
+                                                            _learned(nullptr),
+                                                            _learned_changes(0),
+                                                            _compare(compare),
+                                                            _serializer(s) {
+    assert(max_height <= MAX_HEIGHT_LIMIT);
+    assert(_pd > 1);
+    if ((_pd & (_pd - 1)) == 0) {
+        while ((1 << _pd_shift) < _pd) {
+            _pd_shift++;
+        }
+    }
+    _head = new_node(Key(), _max_h);
+    for (int i = 0; i < MAX_HEIGHT_LIMIT; i++) {
+        _tails[i].store(nullptr, std::memory_order_relaxed);
+    }
 }
 
-template<class Key, class Value>
-Skiplist<Key, Value>::~Skiplist() {
-    for(auto& p : _all_nodes) {
-        free(p);
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::~Skiplist() {
+    stop_top_index();
+    _trainer.stop();
+    TopIndex* index = _top_index.load(std::memory_order_acquire);
+    if (index) {
+        TopIndex::destroy(index);
+    }
+    LearnedIndex* learned = _learned.load(std::memory_order_acquire);
+    if (learned) {
+        LearnedIndex::destroy(learned);
+    }
+    // nodes still reachable on level 0 are not retired yet,
+    // the retired ones are freed by the reclaimer
+    Node* p = _head;
+    while(p) {
+        Node* next = unmarked(p->next(0));
+        p->reclaim(p);
+        p = next;
     }
 }
 
-template<class Key, class Value>
-void Skiplist<Key, Value>::_add(const Key &key, const Value &value, int height) {
-    std::vector<Node*> need_update(_max_h, nullptr);
-    Node* next = find_greater_or_equal(key, &need_update);
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class K, class... Args>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::_add(Guard& guard, int height, K&& key, Args&&... args) {
+    // only the levels up to height are filled in by the searches below
+    Node* preds[MAX_HEIGHT_LIMIT];
+    Node* succs[MAX_HEIGHT_LIMIT];
+    // make the search below start at least at the new node's top level,
+    // so preds and succs are filled for every level it will be linked on
+    raise_current_list_height(height);
 
-    if (next && (next->key == key)) {
-        next->set_value(value);
-        return;
+    // the first search starts at the end of the list, or is skipped
+    // when the key goes after every other one, the summaries need
+    // the predecessors a full search finds
+    Node* start = nullptr;
+    int start_level = 0;
+    if constexpr (!Augment::kEnabled) {
+        start = tail_finger(guard, key, height, preds, succs, start_level);
+    }
+
+    // link level 0 first, that is the point the key becomes visible,
+    // retry the search whenever a concurrent writer changed the predecessor,
+    // once the node is built the key and value have been moved into it
+    Node* add_node = nullptr;
+    const Key* k = &key;
+    while (true) {
+        Node* next = nullptr;
+        if (!start || (start_level >= 0)) {
+            next = find_greater_or_equal(guard, *k, preds, succs, height, start, start_level);
+        }
+        start = nullptr;
+        start_level = 0;
+        if (next && equal(next, *k)) {
+            if (add_node) {
+                update_value(guard, next, std::move(add_node->unpublished_value()));
+                // never published, so nobody else can see it
+                discard_node(add_node);
+            } else {
+                update_value(guard, next, std::forward<Args>(args)...);
+            }
+            if (Augment::kValueDependent) {
+                // the value cell can only be replaced by a writer holding the lock
+                next->set_summary(0, Augment::of(next->key, next->value_cell().load()->value));
+                refresh_summaries(preds, *k);
+            }
+            return;
+        }
+
+        if (!add_node) {
+            add_node = new_node(std::forward<K>(key), height, std::forward<Args>(args)...);
+            k = &add_node->key;
+        }
+        for (int i = 0; i < height; i++) {
+            add_node->set_next(i, succs[i]);
+        }
+        if (preds[0]->cas_next(0, succs[0], add_node)) {
+            break;
+        }
+    }
+    if constexpr (kEntryTable) {
+        cover_entry_key(guard, *k);
+        if (_entry_layer.load(std::memory_order_relaxed) == LEARNED_LAYER) {
+            note_learned_change(add_node);
+        }
     }
 
-    if (height > get_current_list_height()) {
-        for (int i = get_current_list_height(); i < height; i++) {
-            need_update[i] = _head;
+    // link the upper levels, these are only shortcuts for the search,
+    // stop as soon as an eraser has marked the node
+    int linked_height = 1;
+    for (int i = 1; i < height; i++) {
+        // count the level before it becomes reachable there,
+        // so a concurrent unlink of it can't retire the node too early
+        add_node->refs.fetch_add(1, std::memory_order_relaxed);
+        if (!link_level(guard, add_node, i, height, preds, succs)) {
+            add_node->refs.fetch_sub(1, std::memory_order_relaxed);
+            break;
         }
-        set_current_list_height(height);
+        linked_height = i + 1;
     }
 
-    Node* add_node = new_node(key, value, height);
-    for (int i = 0; i < height; i++) {
-        add_node->set_next(i, need_update[i]->next(i));
-        need_update[i]->set_next(i, add_node);
+    // the next appends go after the node on the levels it ends,
+    // it is not retired before the reference of this insert is dropped
+    for (int i = 0; i < linked_height; i++) {
+        if (add_node->next(i) == nullptr) {
+            _tails[i].store(add_node, std::memory_order_release);
+        }
     }
+
+    // an eraser may have finished its unlinking pass
+    // before the last levels were linked, unlink them again
+    if (add_node->is_erased()) {
+        find_greater_or_equal(guard, *k, nullptr, nullptr, height);
+    } else if constexpr (kEntryTable) {
+        if (linked_height == height) {
+            enter_entry_node(add_node);
+        }
+    }
+    if (Augment::kEnabled) {
+        refresh_summaries(preds, *k);
+    }
+    release_node(guard, add_node);
 }
 
-template<class Key, class Value>
-void Skiplist<Key, Value>::insert(const Key &key, const Value &value) {
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::link_level(Guard& guard, Node* n, int level, int height,
+                                                                   Node** preds, Node** succs) {
+    while (true) {
+        Node* old = n->next(level);
+        if (is_marked(old) ||
+            ((old != succs[level]) && !n->cas_next(level, old, succs[level]))) {
+            return false;
+        }
+        if (preds[level]->cas_next(level, succs[level], n)) {
+            return true;
+        }
+        if (find_greater_or_equal(guard, n->key, preds, succs, height) != n) {
+            // already erased and unlinked on level 0
+            return false;
+        }
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::link_run(Guard& guard, Node** nodes, size_t n,
+                                                                 Node** firsts, Node** lasts, int height) {
+    // the levels no search filled yet start the next one from the head
+    Node* preds[MAX_HEIGHT_LIMIT];
+    Node* succs[MAX_HEIGHT_LIMIT];
+    std::fill(preds, preds + MAX_HEIGHT_LIMIT, _head);
+    raise_current_list_height(height);
+
+    // whether firsts and lasts are the ones of nodes[i, n)
+    bool built = true;
+    // the paths of the nodes in [warm_begin, warmed) were looked up,
+    // the one of nodes[k] is kept in paths[(k - warm_begin) * MAX_HEIGHT_LIMIT, ..)
+    Node* paths[LINK_RUN_WARM_WIDTH * MAX_HEIGHT_LIMIT];
+    size_t warm_begin = 0;
+    size_t warmed = 0;
+    size_t i = 0;
+    while (i < n) {
+        // the gap of the list the next node goes into, searched on
+        // the levels of the nodes going into it, from where the last
+        // search ended, the summaries need the predecessors on every level
+        int need = built ? height : nodes[i]->height;
+        Node* next = nullptr;
+        size_t end = n;
+        int run_height = height;
+        // the first search of a warmed node starts from its path, if the guard
+        // keeps the nodes on it, the later ones need the predecessors it found
+        bool from_path = Reclaimer::kGuardKeepsAll && (i >= warm_begin) && (i < warmed);
+        while (true) {
+            int start_level = 0;
+            Node* start = nullptr;
+            if constexpr (!Augment::kEnabled) {
+                Node** from = from_path ? paths + (i - warm_begin) * MAX_HEIGHT_LIMIT : preds;
+                start = resume_point(guard, from, nodes[i]->key, need, start_level);
+            }
+            from_path = false;
+            next = find_greater_or_equal(guard, nodes[i]->key, preds, succs, need, start, start_level);
+            if (next && equal(next, nodes[i]->key)) {
+                break;
+            }
+            // the nodes before next fill the gap, unless all of them do,
+            // their towers are built again left to right, nobody sees them yet
+            if (!built || (next && !less(nodes[n - 1]->key, next->key))) {
+                built = false;
+                run_height = 0;
+                for (end = i; (end < n) && (!next || less(nodes[end]->key, next->key)); end++) {
+                    Node* node = nodes[end];
+                    for (int l = 0; l < node->height; l++) {
+                        if (l < run_height) {
+                            lasts[l]->set_next(l, node);
+                        } else {
+                            firsts[l] = node;
+                        }
+                        lasts[l] = node;
+                    }
+                    run_height = std::max(run_height, node->height);
+                }
+            }
+            if (run_height <= need) {
+                break;
+            }
+            need = run_height;
+        }
+        if (next && equal(next, nodes[i]->key)) {
+            update_value(guard, next, std::move(nodes[i]->unpublished_value()));
+            if (Augment::kValueDependent) {
+                next->set_summary(0, Augment::of(next->key, next->value_cell().load()->value));
+                refresh_summaries(preds, next->key);
+            }
+            discard_node(nodes[i]);
+            i++;
+            built = false;
+            continue;
+        }
+        for (int l = 0; l < run_height; l++) {
+            lasts[l]->set_next(l, succs[l]);
+        }
+        // the point all of them become visible
+        if (!preds[0]->cas_next(0, succs[0], nodes[i])) {
+            continue;
+        }
+        if constexpr (kEntryTable) {
+            cover_entry_key(guard, nodes[i]->key);
+            cover_entry_key(guard, nodes[end - 1]->key);
+            if (_entry_layer.load(std::memory_order_relaxed) == LEARNED_LAYER) {
+                for (size_t k = i; k < end; k++) {
+                    note_learned_change(nodes[k]);
+                }
+            }
+        }
+
+        // link the upper levels the same way, unless a concurrent writer
+        // put a node into the range of the run on that level meanwhile,
+        // then its nodes are linked there one by one
+        bool chained = true;
+        for (int l = 1; l < run_height; l++) {
+            bool linked = false;
+            while (true) {
+                if (succs[l] && !less(lasts[l]->key, succs[l]->key)) {
+                    break;
+                }
+                Node* old = lasts[l]->next(l);
+                if (is_marked(old) ||
+                    ((old != succs[l]) && !lasts[l]->cas_next(l, old, succs[l]))) {
+                    break;
+                }
+                if (preds[l]->cas_next(l, succs[l], firsts[l])) {
+                    linked = true;
+                    break;
+                }
+                find_greater_or_equal(guard, firsts[l]->key, preds, succs, l + 1);
+            }
+            if (linked) {
+                continue;
+            }
+            chained = false;
+            for (size_t k = i; k < end; k++) {
+                Node* node = nodes[k];
+                if (node->height <= l) {
+                    continue;
+                }
+                if ((find_greater_or_equal(guard, node->key, preds, succs, l + 1) != node) ||
+                    !link_level(guard, node, l, l + 1, preds, succs)) {
+                    node->refs.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // the next appends go after the run on the levels it ends
+        for (int l = 0; l < run_height; l++) {
+            if (lasts[l]->next(l) == nullptr) {
+                _tails[l].store(lasts[l], std::memory_order_release);
+            }
+        }
+        if (Augment::kEnabled) {
+            // the writers are serialized, so the predecessors are still the ones of the gap
+            refresh_summaries(preds, nodes[end - 1]->key);
+        }
+        if constexpr (kEntryTable) {
+            if (chained && !nodes[end - 1]->is_erased()) {
+                enter_entry_node(nodes[end - 1]);
+            }
+        }
+        // erasers may have finished their unlinking pass before
+        // the last levels were linked, unlink them again
+        for (size_t k = i; k < end; k++) {
+            if (nodes[k]->is_erased()) {
+                find_greater_or_equal(guard, nodes[k]->key, nullptr, nullptr, nodes[k]->height);
+            }
+            release_node(guard, nodes[k]);
+        }
+        // short runs cost a search each, then look up the paths of the next
+        // nodes together first, so their cache misses overlap, the searches
+        // start from the paths, or find the nodes on them in the cache
+        if ((end - i <= 2) && (end >= warmed) && (end < n)) {
+            warm_begin = end;
+            warmed = std::min(n, end + LINK_RUN_WARM_WIDTH);
+            run_probes(guard, warmed - end, [nodes, end](size_t k) { return &nodes[end + k]->key; },
+                       [](Probe&) {}, nullptr, Reclaimer::kGuardKeepsAll ? paths : nullptr);
+        }
+        i = end;
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::insert(const Key &key, const Value &value) {
+    int height = random_height();
+    WriteLock lock(*this);
+    Guard guard(_reclaimer);
+    _add(guard, height, key, value);
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::insert(Key&& key, Value&& value) {
+    int height = random_height();
+    WriteLock lock(*this);
+    Guard guard(_reclaimer);
+    _add(guard, height, std::move(key), std::move(value));
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class... Args>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::emplace(Key key, Args&&... args) {
     int height = random_height();
-    return _add(key, value, height);
+    WriteLock lock(*this);
+    Guard guard(_reclaimer);
+    _add(guard, height, std::move(key), std::forward<Args>(args)...);
 }
 
-template<class Key, class Value>
-bool Skiplist<Key, Value>::erase(const Key &key) {
-    std::vector<Node*> need_update(_max_h, nullptr);
-    Node* ge = find_greater_or_equal(key, &need_update);
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class K>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::erase_as(const K &key) {
+    WriteLock lock(*this);
+    Guard guard(_reclaimer);
+    // the predecessors are only needed to recompute the summaries
+    Node* preds[MAX_HEIGHT_LIMIT];
+    Node* ge = find_greater_or_equal(guard, key, Augment::kEnabled ? preds : nullptr);
 
-    if ((ge == nullptr) || (ge->key != key)) {
+    if ((ge == nullptr) || !equal(ge, key)) {
         return false;
     }
 
+    // mark from the top down, so the node stops being a shortcut first,
+    // marking level 0 is the point the key disappears,
+    // only one of the concurrent erasers succeeds there
     int height = ge->height;
-    for (int i = 0; i < height; i++) {
-        need_update[i]->set_next(i, ge->next(i));
+    for (int i = height - 1; i > 0; i--) {
+        ge->mark_next(i);
+    }
+    if (!ge->mark_next(0)) {
+        return false;
+    }
+    if constexpr (kEntryTable) {
+        if (_entry_layer.load(std::memory_order_relaxed) == LEARNED_LAYER) {
+            note_learned_change(ge);
+        }
     }
 
-    // update the skiplist's height
-    int new_cur_height = 1;
-    Node* p = _head->next(0);
-    while(p) {
-        new_cur_height = p->height > new_cur_height ? p->height : new_cur_height;
-        p = p->next(0);
+    // unlink it physically, a concurrent search may have done part of it,
+    // the one unlinking its last level retires it
+    find_greater_or_equal(guard, key, nullptr, nullptr, height);
+    if (Augment::kEnabled) {
+        refresh_summaries(preds, ge->key);
     }
-    set_current_list_height(new_cur_height);
+
+    // the node may have been the last one on the top levels
+    lower_current_list_height();
 
     return true;
 }
 
-template<class Key, class Value>
-bool Skiplist<Key, Value>::read(const Key &key, Value &value) {
-    Node* next = find_greater_or_equal(key, nullptr);
-    if (next && next->key == key) {
-        value = next->value();
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class K>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::read_as(const K &key, Value &value) {
+    Guard guard(_reclaimer);
+    Node* next = find_greater_or_equal(guard, key, nullptr);
+    if (next && equal(next, key)) {
+        value = read_value(guard, next);
         return true;
     }
 
     return false;
 }
 
-template<class Key, class Value>
-bool Skiplist<Key, Value>::dump_to(const std::string &path) {
-    Node* p = _head->next(0);
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::dump_to(const std::string &path) {
+    Guard guard(_reclaimer);
+    Node* p = next_node(guard, _head);
     nlohmann::json all_nodes;
     while(p) {
         nlohmann::json node;
         std::string k_str = _serializer->serialize_key(p->key);
-        std::string v_str = _serializer->serialize_value(p->value());
+        std::string v_str = _serializer->serialize_value(read_value(guard, p));
         node["NODE_KEY"] = k_str;
         node["NODE_VALUE"] = v_str;
         node["NODE_HEIGHT"] = p->height;
 
         all_nodes.push_back(node);
 
-        p = p->next(0);
+        guard.set(scratch_slot(TRAIL_SLOT), p);
+        p = next_node(guard, p);
     }
 
     std::ofstream o(path);
@@ -226,32 +1692,166 @@ bool Skiplist<Key, Value>::dump_to(const std::string &path) {
     return true;
 }
 
-template<class Key, class Value>
-bool Skiplist<Key, Value>::load_from(const std::string &path) {
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::load_from(const std::string &path) {
     std::ifstream i(path);
     nlohmann::json all_nodes;
     i >> all_nodes;
+    SortedBuilder builder(this);
+    builder.reserve(all_nodes.size());
     for(auto it = all_nodes.begin(); it != all_nodes.end(); it++) {
         nlohmann::json node_json = *it;
         Key node_k = _serializer->deserialize_to_key(node_json["NODE_KEY"]);
         Value node_v = _serializer->deserialize_to_value(node_json["NODE_VALUE"]);
         int h = node_json["NODE_HEIGHT"];
-        _add(node_k, node_v, h);
+        builder.add(std::move(node_k), std::move(node_v), h);
     }
+    builder.publish();
+
+    return true;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class It>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::bulk_load(It begin, It end) {
+    SortedBuilder builder(this);
+    if constexpr (std::is_base_of<std::forward_iterator_tag,
+                                  typename std::iterator_traits<It>::iterator_category>::value) {
+        builder.reserve(std::distance(begin, end));
+    }
+    for (; begin != end; ++begin) {
+        builder.add(begin->first, begin->second);
+    }
+    builder.publish();
 }
 
-template<class Key, class Value>
-typename Skiplist<Key, Value>::Node*
-Skiplist<Key, Value>::find_greater_or_equal(const Key &k,
-                                            std::vector<Node*>* vec) {
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::insert_batch(const std::pair<Key, Value>* batch, size_t n) {
+    if (n == 1) {
+        insert(batch[0].first, batch[0].second);
+        return;
+    }
+    // repeated keys stay in batch order, so the later value is added last
+    std::vector<const std::pair<Key, Value>*> sorted(n);
+    for (size_t i = 0; i < n; i++) {
+        sorted[i] = &batch[i];
+    }
+    std::sort(sorted.begin(), sorted.end(), [this](const std::pair<Key, Value>* a, const std::pair<Key, Value>* b) {
+        return less(a->first, b->first) || (!less(b->first, a->first) && (a < b));
+    });
+    SortedBuilder builder(this);
+    builder.reserve(n);
+    for (const std::pair<Key, Value>* pair : sorted) {
+        builder.add(pair->first, pair->second);
+    }
+    builder.publish();
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::SortedBuilder::add(Key key, Value value, int height) {
+    if (!_nodes.empty()) {
+        Node* last = _nodes.back();
+        if (!_list->less(last->key, key)) {
+            if (!_list->less(key, last->key)) {
+                last->unpublished_value() = std::move(value);
+                if (Augment::kEnabled) {
+                    last->set_summary(0, Augment::of(last->key, last->unpublished_value()));
+                }
+                return;
+            }
+            publish();
+        }
+    }
+    height = (height > 0) ? std::min(height, _list->_max_h) : _list->random_height();
+    Node* node = _list->new_node(std::move(key), height, std::move(value));
+    for (int l = 0; l < height; l++) {
+        if (l < _height) {
+            _lasts[l]->set_next(l, node);
+        } else {
+            _firsts[l] = node;
+        }
+        _lasts[l] = node;
+    }
+    _height = std::max(_height, height);
+    // all of its levels and the reference of publish
+    node->refs.store(height + 1, std::memory_order_relaxed);
+    _nodes.push_back(node);
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::SortedBuilder::publish() {
+    if (_nodes.empty()) {
+        return;
+    }
+    WriteLock lock(*_list);
+    Guard guard(_list->_reclaimer);
+    _list->link_run(guard, _nodes.data(), _nodes.size(), _firsts, _lasts, _height);
+    _nodes.clear();
+    _height = 0;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class Walker>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::Node*
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::find_position(Guard& guard,
+                                                                 Walker&& walker,
+                                                                 Node** vec,
+                                                                 Node** succs,
+                                                                 int height,
+                                                                 Node* start,
+                                                                 int start_level) {
+    // the head is never freed, every other node is loaded through the guard:
+    // p is kept in PRED_SLOT, next in CURR_SLOT and the node after it in SUCC_SLOT
+retry:
+    walker.restart();
     Node* p = _head;
-    int level = get_current_list_height() - 1;
+    int level = std::max(get_current_list_height(), height) - 1;
+    if (start && (start != _head)) {
+        // only the first attempt starts there, if start is erased
+        // the search starts over from the head
+        p = start;
+        level = start_level;
+        guard.set(scratch_slot(PRED_SLOT), p);
+    }
+    start = nullptr;
     while(true) {
-        Node* next = p->next(level);
-        if(next && (next->key < k)) {
+        Node* next = guard.protect(scratch_slot(CURR_SLOT), p->link(level));
+        if (is_marked(next)) {
+            // p itself is being erased, it can't be a predecessor any more
+            goto retry;
+        }
+        Node* after = nullptr;
+        while (next) {
+            after = guard.protect(scratch_slot(SUCC_SLOT), next->link(level));
+            if (!is_marked(after)) {
+                break;
+            }
+            // help the eraser: snip the marked node out of this level,
+            // after stays linked until then, as the marked link can't change
+            if (!p->cas_next(level, next, unmarked(after))) {
+                goto retry;
+            }
+            release_node(guard, next);
+            next = unmarked(after);
+            guard.set(scratch_slot(CURR_SLOT), next);
+        }
+        if (next && after) {
+            // the node after next is read next if the walker steps to next,
+            // load it while the walker compares
+            Node::prefetch(after, level);
+        }
+        if(next && walker.before(next, level)) {
             p = next;
+            guard.set(scratch_slot(PRED_SLOT), p);
         } else {
-            if(vec) (*vec)[level] = p;
+            if(vec) {
+                vec[level] = p;
+                guard.set(pred_slot(level), p);
+            }
+            if(succs) {
+                succs[level] = next;
+                guard.set(succ_slot(level), next);
+            }
             if (level == 0) {
                 return next;
             } else {
@@ -261,27 +1861,830 @@ Skiplist<Key, Value>::find_greater_or_equal(const Key &k,
     }
 }
 
-template<class Key, class Value>
-typename Skiplist<Key, Value>::Node* Skiplist<Key, Value>::new_node(const Key &k,
-                                                                    const Value &v,
-                                                                    int height) {
-    Node* n = new Node(k, v, height);
-    // Attention:
-    // std::vector push_back is not thread-safe,
-    // so this Skiplist can't be written by multi-threads
-    _all_nodes.push_back(n);
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::step_probe(Guard& guard, Probe& probe) {
+    // p is kept in PRED_SLOT of the probe, next in its CURR_SLOT
+    // and the node after it in its SUCC_SLOT
+retry:
+    Node* next = guard.protect(batch_slot(probe.slot, CURR_SLOT), probe.p->link(probe.level));
+    if (is_marked(next)) {
+        restart_probe(probe);
+        goto retry;
+    }
+    Node* after = nullptr;
+    while (next) {
+        after = guard.protect(batch_slot(probe.slot, SUCC_SLOT), next->link(probe.level));
+        if (!is_marked(after)) {
+            break;
+        }
+        if (!probe.p->cas_next(probe.level, next, unmarked(after))) {
+            restart_probe(probe);
+            goto retry;
+        }
+        release_node(guard, next);
+        next = unmarked(after);
+        guard.set(batch_slot(probe.slot, CURR_SLOT), next);
+    }
+    if (next && less(next, *probe.key, probe.kp)) {
+        probe.p = next;
+        guard.set(batch_slot(probe.slot, PRED_SLOT), next);
+        if (after) {
+            Node::prefetch(after, probe.level);
+        }
+        return false;
+    }
+    if (probe.path) {
+        probe.path[probe.level] = probe.p;
+    }
+    if (probe.level == 0) {
+        probe.result = next;
+        return true;
+    }
+    probe.level--;
+    Node* below = unmarked(probe.p->next(probe.level));
+    if (below) {
+        Node::prefetch(below, probe.level);
+    }
+    return false;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class KeyAt, class Done>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::run_probes(Guard& guard,
+                                                                   size_t n,
+                                                                   KeyAt key_at,
+                                                                   Done done,
+                                                                   Node** preds,
+                                                                   Node** paths) {
+    Probe probes[READ_BATCH_WIDTH];
+    int active = 0;
+    size_t issued = 0;
+    for (; (active < READ_BATCH_WIDTH) && (issued < n); active++, issued++) {
+        probes[active].slot = active;
+        start_probe(probes[active], key_at(issued), issued,
+                    paths ? paths + issued * MAX_HEIGHT_LIMIT : nullptr);
+        if (preds) {
+            resume_probe(guard, probes[active], preds);
+        }
+    }
+
+    // step the probes round robin, a finished probe takes the next key,
+    // when none is left the last probe moves into its place
+    int i = 0;
+    while (active > 0) {
+        Probe& probe = probes[i];
+        if (step_probe(guard, probe)) {
+            done(probe);
+            if (issued < n) {
+                start_probe(probe, key_at(issued), issued,
+                            paths ? paths + issued * MAX_HEIGHT_LIMIT : nullptr);
+                if (preds) {
+                    resume_probe(guard, probe, preds);
+                }
+                issued++;
+            } else {
+                active--;
+                if (i != active) {
+                    probe = probes[active];
+                    // its nodes are protected in the slots of the old place
+                    guard.set(batch_slot(i, PRED_SLOT), probe.p);
+                    probe.slot = i;
+                    continue;
+                }
+            }
+        }
+        i = (i + 1 < active) ? i + 1 : 0;
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+size_t Skiplist<Key, Value, Reclaimer, Augment, Compare>::read_batch(const Key* keys,
+                                                                     size_t n,
+                                                                     Value* values,
+                                                                     bool* found) {
+    Guard guard(_reclaimer);
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    auto key_less = [this, keys](size_t a, size_t b) { return less(keys[a], keys[b]); };
+    if (!std::is_sorted(order.begin(), order.end(), key_less)) {
+        std::sort(order.begin(), order.end(), key_less);
+    }
+
+    size_t found_num = 0;
+    Node* preds[MAX_HEIGHT_LIMIT];
+    std::fill(preds, preds + MAX_HEIGHT_LIMIT, _head);
+    for (size_t i = 0; i < n; i += READ_BATCH_WINDOW) {
+        size_t width = std::min(n - i, static_cast<size_t>(READ_BATCH_WINDOW));
+        run_probes(guard, width, [&](size_t k) { return &keys[order[i + k]]; }, [&](Probe& probe) {
+            Node* ge = probe.result;
+            size_t index = order[i + probe.index];
+            found[index] = ge && equal(ge, keys[index]);
+            if (found[index]) {
+                values[index] = read_value(guard, ge);
+                found_num++;
+            }
+        }, preds);
+        if (i + width < n) {
+            // record the path to the last key of the window,
+            // the probes have brought it into the cache
+            const Key& last = keys[order[i + width - 1]];
+            int level = 0;
+            Node* start = resume_point(guard, preds, last, 1, level);
+            find_greater_or_equal(guard, last, preds, nullptr, 1, start, level);
+        }
+    }
+    return found_num;
+}
+
+#ifdef SKIPLIST_HAS_COROUTINES
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::LookupTask
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::lookup_keys(Guard& guard,
+                                                               int slot,
+                                                               std::span<const Key> keys,
+                                                               std::span<std::optional<Value>> values,
+                                                               size_t* next,
+                                                               size_t* found_num) {
+    Probe probe;
+    probe.slot = slot;
+    while (*next < keys.size()) {
+        start_probe(probe, &keys[*next], *next);
+        (*next)++;
+        // step_probe prefetched the node the next step reads
+        while (!step_probe(guard, probe)) {
+            co_await std::suspend_always();
+        }
+        Node* ge = probe.result;
+        if (ge && equal(ge, *probe.key)) {
+            values[probe.index] = read_value(guard, ge);
+            (*found_num)++;
+        } else {
+            values[probe.index].reset();
+        }
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+size_t Skiplist<Key, Value, Reclaimer, Augment, Compare>::read_batch_coroutines(std::span<const Key> keys,
+                                                                                std::span<std::optional<Value>> values,
+                                                                                int width) {
+    assert(values.size() >= keys.size());
+    // every lookup in flight needs guard slots of its own
+    width = std::max(1, std::min(width, READ_BATCH_WIDTH));
+    Guard guard(_reclaimer);
+    size_t next = 0;
+    size_t found_num = 0;
+    std::vector<LookupTask> tasks;
+    tasks.reserve(width);
+    for (int i = 0; (i < width) && ((size_t)i < keys.size()); i++) {
+        tasks.push_back(lookup_keys(guard, i, keys, values, &next, &found_num));
+    }
+
+    // resume the lookups round robin until all keys are taken and done
+    size_t active = tasks.size();
+    while (active > 0) {
+        for (LookupTask& task : tasks) {
+            if (!task.done()) {
+                task.resume();
+                if (task.done()) {
+                    active--;
+                }
+            }
+        }
+    }
+
+    return found_num;
+}
+#endif
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::Node*
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::entry_point(Guard& guard, const Key& key) {
+    EntryTable* t = _entries.load(std::memory_order_acquire);
+    uint64_t u = EntryKey::of(key);
+    if (!t || !t->covers(u)) {
+        return nullptr;
+    }
+    size_t b = t->bucket(u);
+    Node* e = t->slots[b].load(std::memory_order_acquire);
+    if (e && ((e == _head) || less(e->key, key)) && !e->is_erased()) {
+        return e;
+    }
+
+    // fill the slot: search for the start of the bucket and take the closest
+    // of its predecessors, or a taller one at most a bucket's width before it,
+    // a lookup starts at the top level of the hint, so it must have been met
+    // there: the upper levels of a node still being inserted are not linked yet
+    uint64_t first = t->bucket_start(b);
+    int top = get_current_list_height();
+    Node* preds[MAX_HEIGHT_LIMIT];
+    find_greater_or_equal(guard, EntryKey::key_of(first), preds, nullptr, top);
+    Node* hint = _head;
+    for (int level = 0; (level < top) && (preds[level] != _head); level++) {
+        Node* p = preds[level];
+        if (p->height - 1 != level) {
+            continue;
+        }
+        if ((hint != _head) && (first - EntryKey::of(p->key) > (uint64_t(1) << t->shift))) {
+            break;
+        }
+        hint = p;
+    }
+    // the start of the bucket may lie outside the keys, then the search
+    // was for the least or greatest key, whose predecessors may not be before key
+    if ((hint != _head) && !less(hint->key, key)) {
+        hint = _head;
+    }
+    t->slots[b].store(hint, std::memory_order_release);
+    return hint;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::cover_entry_key(Guard& guard, const Key& key) {
+    uint64_t u = EntryKey::of(key);
+    // about log2 of the number of nodes
+    int pd_bits = 63 - __builtin_clzll(_pd);
+    int size_bits = std::max(std::min(pd_bits * get_current_list_height(), ENTRY_TABLE_MAX_BITS), 1);
+    EntryTable* t = _entries.load(std::memory_order_acquire);
+    while (!t || !t->covers(u) || ((t->bits < size_bits) && (t->shift > 0))) {
+        // cover twice the span of the keys, with a slot for
+        // about every node, the slots start empty
+        uint64_t lo = u;
+        uint64_t hi = u;
+        Node* first = next_node(guard, _head);
+        if (first) {
+            lo = std::min(lo, EntryKey::of(first->key));
+        }
+        Node* last = find_last_before(guard, by_node([](Node* n) { return true; }));
+        if (last) {
+            hi = std::max(hi, EntryKey::of(last->key));
+        }
+        int width = hi - lo == UINT64_MAX ? 64 : 64 - __builtin_clzll((hi - lo) | 1) + 1;
+        width = std::min(width, 64);
+        int bits = std::min(width, size_bits);
+        int shift = width - bits;
+        uint64_t base = shift >= 64 ? 0 : (lo >> shift) << shift;
+        // a table that loses the race is left in the arena too
+        EntryTable* fresh = EntryTable::create(_arena, base, shift, bits);
+        if (_entries.compare_exchange_strong(t, fresh, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+            break;
+        }
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::enter_entry_node(Node* n) {
+    EntryTable* t = _entries.load(std::memory_order_acquire);
+    uint64_t u = EntryKey::of(n->key);
+    if (!t || !t->covers(u)) {
+        return;
+    }
+    // the keys of the next buckets are all after n, an empty slot
+    // is left to the lookups, one past n is already closer
+    size_t size = size_t(1) << t->bits;
+    size_t b = t->bucket(u) + 1;
+    for (size_t end = std::min(size, b + ENTRY_TABLE_WRITER_SLOTS); b < end; b++) {
+        Node* e = t->slots[b].load(std::memory_order_acquire);
+        if (!e || ((e != _head) && !less(e->key, n->key))) {
+            break;
+        }
+        if (!t->slots[b].compare_exchange_strong(e, n, std::memory_order_acq_rel)) {
+            break;
+        }
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::set_entry_layer(EntryLayer layer) {
+    if constexpr (kEntryTable) {
+        if (layer == LEARNED_LAYER) {
+            {
+                std::lock_guard<std::mutex> lock(_learned_lock);
+                train_learned();
+            }
+            _trainer.start(std::chrono::milliseconds(LEARNED_INDEX_INTERVAL_MS), [this]() { refresh_learned(); });
+        } else {
+            _trainer.stop();
+        }
+        _entry_layer.store(layer, std::memory_order_relaxed);
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::Node*
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::learned_point(const Key& key, int& level) {
+    EpochReclamation::Guard pin(_snapshots);
+    LearnedIndex* m = _learned.load(std::memory_order_acquire);
+    uint64_t u = EntryKey::of(key);
+    if (!m || m->keys.empty() || (u <= m->keys.front()) || (u > m->keys.back())) {
+        return nullptr;
+    }
+    const std::vector<uint64_t>& keys = m->keys;
+    size_t n = keys.size();
+    auto segment = std::upper_bound(m->segments.begin(), m->segments.end(), u,
+                                    [](uint64_t u, const LearnedSegment& s) { return u < s.first; }) - 1;
+    double predicted = double(segment->start) + segment->slope * double(u - segment->first);
+    size_t lo = std::min(size_t(std::max(predicted - LEARNED_INDEX_ERROR - 1, 0.0)), n - 1);
+    size_t hi = std::min(size_t(std::max(predicted + LEARNED_INDEX_ERROR + 2, 0.0)), n);
+    hi = std::max(hi, lo + 1);
+    // the first key >= u is in the window, unless u is not a modeled key
+    // and falls between two segments, search all the keys then
+    if (((lo > 0) && (keys[lo] >= u)) || ((hi < n) && (keys[hi - 1] < u))) {
+        lo = 0;
+        hi = n;
+    }
+    size_t i = std::lower_bound(keys.begin() + lo, keys.begin() + hi, u) - keys.begin();
+    level = m->level;
+    return m->nodes[i - 1];
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::refresh_learned() {
+    std::lock_guard<std::mutex> lock(_learned_lock);
+    LearnedIndex* m = _learned.load(std::memory_order_acquire);
+    size_t modeled = m ? m->nodes.size() : 0;
+    if (_learned_changes.load(std::memory_order_relaxed) * LEARNED_INDEX_RETRAIN_DENOMINATOR > modeled) {
+        train_learned();
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::train_learned() {
+    // changes made from here on may be missed by the walk below
+    _learned_changes.store(0, std::memory_order_relaxed);
+    std::unique_ptr<LearnedIndex> fresh(new LearnedIndex());
+    fresh->level = learned_level();
+    collect_level(fresh->level, SIZE_MAX, nullptr, fresh->nodes);
+    std::vector<uint64_t>& keys = fresh->keys;
+    keys.reserve(fresh->nodes.size());
+    for (Node* n : fresh->nodes) {
+        keys.push_back(EntryKey::of(n->key));
+    }
+
+    // greedy segments: a segment takes the next key as long as some slope
+    // keeps every key it has within LEARNED_INDEX_ERROR positions
+    size_t n = keys.size();
+    size_t i = 0;
+    while (i < n) {
+        LearnedSegment segment = {keys[i], i, 0.0};
+        double lo = 0.0;
+        double hi = HUGE_VAL;
+        size_t j = i + 1;
+        for (; j < n; j++) {
+            double dx = double(keys[j] - segment.first);
+            double dy = double(j - i);
+            double l = std::max(lo, (dy - LEARNED_INDEX_ERROR) / dx);
+            double h = std::min(hi, (dy + LEARNED_INDEX_ERROR) / dx);
+            if (l > h) {
+                break;
+            }
+            lo = l;
+            hi = h;
+        }
+        segment.slope = j == i + 1 ? 0.0 : (lo + hi) / 2;
+        fresh->segments.push_back(segment);
+        i = j;
+    }
+
+    LearnedIndex* old = _learned.exchange(fresh.release(), std::memory_order_acq_rel);
+    if (old) {
+        EpochReclamation::Guard guard(_snapshots);
+        guard.retire(old);
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::start_top_index(std::chrono::milliseconds interval) {
+    stop_top_index();
+    refresh_top_index(0);
+    _indexer.start(interval, [this]() { refresh_top_index(TOP_INDEX_STALE_DENOMINATOR); });
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::stop_top_index() {
+    _indexer.stop();
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::collect_level(int level, size_t limit,
+                                                                      std::vector<Key>* keys,
+                                                                      std::vector<Node*>& nodes) {
+    // nodes are never freed early here, so the level is walked without a guard
+    for (Node* p = unmarked(_head->next(level)); p; p = unmarked(p->next(level))) {
+        if (p->is_erased()) {
+            continue;
+        }
+        if (nodes.size() == limit) {
+            return false;
+        }
+        nodes.push_back(p);
+        if (keys) {
+            keys->push_back(p->key);
+        }
+    }
+    return true;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::refresh_top_index(size_t stale_denominator) {
+    // collect_level walks the nodes without a guard
+    static_assert(!Reclaimer::kReclaimsEarly, "the top level index needs nodes that are never freed early");
+    // index the lowest level with at most TOP_INDEX_MAX_NODES nodes
+    int level = get_current_list_height() - 1;
+    std::vector<Node*> nodes;
+    while (level > 0) {
+        nodes.clear();
+        if (!collect_level(level - 1, TOP_INDEX_MAX_NODES, nullptr, nodes)) {
+            break;
+        }
+        level--;
+    }
+    nodes.clear();
+    std::unique_ptr<TopIndex> fresh(new TopIndex());
+    fresh->level = level;
+    collect_level(level, SIZE_MAX, &fresh->keys, fresh->nodes);
+
+    // count the nodes only one of the snapshots has
+    TopIndex* index = _top_index.load(std::memory_order_acquire);
+    if (index && (index->level == level)) {
+        size_t same = 0;
+        size_t i = 0;
+        size_t j = 0;
+        while ((i < index->nodes.size()) && (j < fresh->nodes.size())) {
+            if (index->nodes[i] == fresh->nodes[j]) {
+                same++;
+                i++;
+                j++;
+            } else if (less(index->keys[i], fresh->keys[j])) {
+                i++;
+            } else {
+                j++;
+            }
+        }
+        size_t changed = index->nodes.size() + fresh->nodes.size() - 2 * same;
+        if ((changed == 0) || (stale_denominator && (changed * stale_denominator <= index->nodes.size()))) {
+            return;
+        }
+    }
+    index = _top_index.exchange(fresh.release(), std::memory_order_acq_rel);
+    if (index) {
+        EpochReclamation::Guard guard(_snapshots);
+        guard.retire(index);
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::Node*
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::next_node(Guard& guard, Node* p) {
+    while(true) {
+        Node* next = guard.protect(scratch_slot(CURR_SLOT), p->link(0));
+        if (is_marked(next)) {
+            // p is erased, the nodes after its frozen link may be freed already
+            return find_greater(guard, p->key);
+        }
+        if (!next) {
+            return nullptr;
+        }
+        Node* after = guard.protect(scratch_slot(SUCC_SLOT), next->link(0));
+        if (!is_marked(after)) {
+            return next;
+        }
+        // skip an erased node by unlinking it, like a search does
+        if (p->cas_next(0, next, unmarked(after))) {
+            release_node(guard, next);
+        }
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class K, class... Args>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::Node*
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::new_node(K&& k, int height, Args&&... args) {
+    size_t bytes = Node::size_of(height);
+    void* mem = Reclaimer::kReclaimsEarly ?
+                ::operator new(bytes) :
+                _arena.allocate(bytes, alignof(Node), Node::hot_size_of(height));
+    return Node::create(mem, std::forward<K>(k), height, std::forward<Args>(args)...);
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::release_node(Guard& guard, Node* n) {
+    if (n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if constexpr (Reclaimer::kReclaimsEarly) {
+            // a finger taken from the tails from now on never sees it
+            for (int i = 0; i < n->height; i++) {
+                Node* expected = n;
+                if (_tails[i].load(std::memory_order_relaxed) == n) {
+                    _tails[i].compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+                }
+            }
+        }
+        guard.retire(n);
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class K>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::Node*
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::tail_finger(Guard& guard, const K& key, int height,
+                                                               Node** preds, Node** succs, int& level) {
+    uint64_t kp = Prefix::of(key);
+    // an erase may lower the list below the height _add raised it to,
+    // the levels of the new node must be filled all the same
+    int top = std::max(get_current_list_height(), height);
+    for (int i = top - 1; i >= 0; i--) {
+        // a level nobody appended to yet, or whose last node was retired,
+        // starts at the head
+        Node* t = guard.protect(pred_slot(i), _tails[i]);
+        if (!t) {
+            t = _head;
+        }
+        if ((t != _head) && !less(t, key, kp)) {
+            if (i == top - 1) {
+                return nullptr;
+            }
+            level = i + 1;
+            return preds[i + 1];
+        }
+        preds[i] = t;
+        succs[i] = nullptr;
+    }
+    // the linking fails if a node follows one of them, and the search is done then
+    level = -1;
+    return preds[0];
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class... Args>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::update_value(Guard& guard, Node* n, Args&&... args) {
+    // the old cell may still be copied by a reader
+    ValueCell* old = n->exchange_value(new ValueCell(std::forward<Args>(args)...));
+    if (old) {
+        guard.retire(old);
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::lower_bound(const Key &key, Key &found, Value &value) {
+    Guard guard(_reclaimer);
+    Node* n = find_greater_or_equal(guard, key, nullptr);
+    if (n) {
+        found = n->key;
+        value = read_value(guard, n);
+        return true;
+    }
+    return false;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::upper_bound(const Key &key, Key &found, Value &value) {
+    Guard guard(_reclaimer);
+    Node* n = find_greater(guard, key);
+    if (n) {
+        found = n->key;
+        value = read_value(guard, n);
+        return true;
+    }
+    return false;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::ReverseIterator::fill(const Key& bound, bool inclusive, bool unbounded) {
+    _bound = bound;
+    auto before = [this, &inclusive, &unbounded](Node* n) {
+        return unbounded || (inclusive ? !_list->less(_bound, n->key) : _list->less(n->key, _bound));
+    };
+    _buffer.clear();
+    _done = false;
+    while (_buffer.empty() && !_done) {
+        // start from a predecessor on _level, about _pd^_level pairs back
+        int level = std::min(_level, _list->get_current_list_height() - 1);
+        Node* start = _list->find_last_before(_guard, by_node(before), level);
+        if (_level < MAX_LEVEL) {
+            _level++;
+        }
+        Node* p = start;
+        if (!p) {
+            _done = true;
+            p = _list->next_node(_guard, _list->_head);
+        } else if (p->is_erased()) {
+            p = _list->next_node(_guard, p);
+        }
+        while (p && before(p)) {
+            _guard.set(_list->scratch_slot(TRAIL_SLOT), p);
+            _buffer.emplace_back(p->key, _list->read_value(_guard, p));
+            p = _list->next_node(_guard, p);
+        }
+        if (!_done) {
+            // the pairs before start come with the next refill,
+            // if start was erased and nothing is left after it, go on at once
+            _bound = start->key;
+            inclusive = false;
+            unbounded = false;
+        }
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+size_t Skiplist<Key, Value, Reclaimer, Augment, Compare>::rank(const Key &key) {
+    static_assert(Augment::kWidths, "rank needs an augmentation with span widths");
+    Guard guard(_reclaimer);
+    return read_summaries([&]() { return count_below(guard, key); });
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+bool Skiplist<Key, Value, Reclaimer, Augment, Compare>::select(size_t k, Key &found, Value &value) {
+    static_assert(Augment::kWidths, "select needs an augmentation with span widths");
+    Guard guard(_reclaimer);
+    Node* n = read_summaries([&]() {
+        auto walker = counting([k](Node* n, size_t r) { return r <= k + 1; });
+        Node* last = find_last_before(guard, walker);
+        return walker.steps == k + 1 ? last : nullptr;
+    });
+    if (n) {
+        found = n->key;
+        value = read_value(guard, n);
+        return true;
+    }
+    return false;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+size_t Skiplist<Key, Value, Reclaimer, Augment, Compare>::count_range(const Key &lo, const Key &hi) {
+    if (!less(lo, hi)) {
+        return 0;
+    }
+    static_assert(Augment::kWidths, "count_range needs an augmentation with span widths");
+    Guard guard(_reclaimer);
+    return read_summaries([&]() { return count_below(guard, hi) - count_below(guard, lo); });
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class Read>
+auto Skiplist<Key, Value, Reclaimer, Augment, Compare>::read_summaries(Read read) -> decltype(read()) {
+    for (int i = 0; i < SUMMARY_READ_RETRIES; i++) {
+        uint64_t seq = _write_seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        auto result = read();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_write_seq.load(std::memory_order_relaxed) == seq) {
+            return result;
+        }
+    }
+    std::lock_guard<std::mutex> lock(_write_lock);
+    return read();
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::Summary
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::aggregate(const Key &lo, const Key &hi) {
+    static_assert(Augment::kValueDependent, "aggregate needs an AggregateAugmentation");
+    Guard guard(_reclaimer);
+    return read_summaries([&]() { return fold(guard, lo, hi); });
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::Summary
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::fold(Guard& guard, const Key &lo, const Key &hi) {
+retry:
+    // p is the last node before lo, then the end of the spans joined so far,
+    // it is kept in TRAIL_SLOT, next in CURR_SLOT
+    Summary sum = Augment::identity();
+    Node* p = find_last_before(guard, by_node([this, &lo](Node* n) { return less(n->key, lo); }));
+    if (!p) {
+        p = _head;
+    }
+    guard.set(scratch_slot(TRAIL_SLOT), p);
+    while (true) {
+        // jump over the widest span after p that still ends inside the range
+        int level = (p == _head ? get_current_list_height() : p->height) - 1;
+        Node* next = nullptr;
+        for (; level >= 0; level--) {
+            next = guard.protect(scratch_slot(CURR_SLOT), p->link(level));
+            if (is_marked(next)) {
+                // p is being erased
+                goto retry;
+            }
+            if (next && !less(hi, next->key)) {
+                break;
+            }
+        }
+        if (level < 0) {
+            return sum;
+        }
+        if (is_marked(guard.protect(scratch_slot(SUCC_SLOT), next->link(level)))) {
+            // next is being erased, its link can't be followed
+            goto retry;
+        }
+        sum = Augment::combine(sum, next->summary(level));
+        p = next;
+        guard.set(scratch_slot(TRAIL_SLOT), p);
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::refresh_summaries(Node** preds, const Key& key) {
+    int top = get_current_list_height();
+    for (int level = 1; level < top; level++) {
+        Node* p = preds[level];
+        while (true) {
+            Node* n = unmarked(p->next(level));
+            if (!n) {
+                break;
+            }
+            // join the spans of the level below from p up to n
+            Summary sum = Augment::identity();
+            Node* q = p;
+            do {
+                q = unmarked(q->next(level - 1));
+                sum = Augment::combine(sum, q->summary(level - 1));
+            } while (q != n);
+            n->set_summary(level, sum);
+            if (less(key, n->key)) {
+                break;
+            }
+            p = n;
+        }
+    }
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+template<class Callback>
+size_t Skiplist<Key, Value, Reclaimer, Augment, Compare>::scan(const Key& begin, const Key& end, size_t limit, Callback cb) {
+    Guard guard(_reclaimer);
+    size_t n = 0;
+    Node* p = find_greater_or_equal(guard, begin, nullptr);
+    while (p && (n < limit) && less(p->key, end)) {
+        guard.set(scratch_slot(TRAIL_SLOT), p);
+        // the cell stays protected while cb reads it
+        cb(p->key, guard.protect(scratch_slot(VALUE_SLOT), p->value_cell())->value);
+        n++;
+        p = next_node(guard, p);
+    }
     return n;
 }
 
-template<class Key, class Value>
-int Skiplist<Key, Value>::random_height() {
-    int height = 1;
-    while((height < _max_h) &&
-          (distribution(generator) % _pd == 0)) {
-        height++;
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+void Skiplist<Key, Value, Reclaimer, Augment, Compare>::seed_height_generator(uint64_t seed) {
+    _height_seed.store(seed, std::memory_order_relaxed);
+    _height_streams.store(0, std::memory_order_relaxed);
+    _height_seed_generation.fetch_add(1, std::memory_order_release);
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::HeightGenerator&
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::height_generator() {
+    static thread_local HeightGenerator cache[HEIGHT_GENERATOR_CACHE_SIZE] = {};
+    HeightGenerator& g = cache[_id % HEIGHT_GENERATOR_CACHE_SIZE];
+    uint64_t generation = _height_seed_generation.load(std::memory_order_acquire);
+    if ((g.owner != _id) || (g.generation != generation)) {
+        // a new stream: mix the seed with the stream number, splitmix64 style
+        uint64_t z = _height_seed.load(std::memory_order_relaxed) +
+                     (_height_streams.fetch_add(1, std::memory_order_relaxed) + 1) * 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        g.owner = _id;
+        g.generation = generation;
+        g.state = z ^ (z >> 31);
+    }
+    return g;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+typename Skiplist<Key, Value, Reclaimer, Augment, Compare>::Finger&
+Skiplist<Key, Value, Reclaimer, Augment, Compare>::finger() {
+    static thread_local Finger cache[FINGER_CACHE_SIZE] = {};
+    Finger& f = cache[_id % FINGER_CACHE_SIZE];
+    if (f.owner != _id) {
+        f.owner = _id;
+        for (int i = 0; i < MAX_HEIGHT_LIMIT; i++) {
+            f.preds[i] = _head;
+        }
+    }
+    return f;
+}
+
+template<class Key, class Value, class Reclaimer, class Augment, class Compare>
+int Skiplist<Key, Value, Reclaimer, Augment, Compare>::random_height() {
+    uint64_t r = wyrand(height_generator().state);
+    int height;
+    if (_pd_shift) {
+        // every _pd_shift bits are zero with probability 1/_pd
+        int zeros = r ? __builtin_ctzll(r) : 64;
+        height = 1 + zeros / _pd_shift;
+    } else {
+        height = 1;
+        while ((r >= (uint64_t)_pd) && (r % _pd == 0)) {
+            height++;
+            r /= _pd;
+        }
     }
 
-    return height;
+    return height < _max_h ? height : _max_h;
 }
 
 #endif //SKIPLIST_CHENFEI_SKIPLIST_HPP
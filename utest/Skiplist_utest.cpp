@@ -2,9 +2,35 @@
 // Created by chenfeiwang on 2/19/22.
 //
 #include "../src/Skiplist.hpp"
+#include "../src/FatSkiplist.hpp"
 #include <gtest/gtest.h>
 #include <string>
 #include <climits>
+#include <thread>
+#include <random>
+#include <fstream>
+#include <set>
+#include <map>
+#include <string_view>
+#include <new>
+#include <memory>
+
+// counts the heap allocations made through operator new
+static std::atomic<long> allocations(0);
+void* operator new(size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(n ? n : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void* p) noexcept {
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
 
 TEST(BaseSerializerTest, SerializeTestKey) {
     BasicSerializer bs;
@@ -144,6 +170,28 @@ TEST(SkiplistTest, AddEraseTest2) {
     EXPECT_FALSE(ret);
 }
 
+TEST(SkiplistTest, EraseAllTest) {
+    // erasing in key order empties the top levels one by one
+    Skiplist<int, int> list(nullptr);
+    const int count = 100000;
+    for (int round = 0; round < 2; round++) {
+        for (int k = 0; k < count; k++) {
+            list.insert(k, k + round);
+        }
+        for (int k = 0; k < count; k++) {
+            ASSERT_TRUE(list.erase(k));
+        }
+        int value;
+        for (int k = 0; k < count; k += 97) {
+            EXPECT_FALSE(list.read(k, value));
+        }
+    }
+    list.insert(7, 7);
+    int value;
+    EXPECT_TRUE(list.read(7, value));
+    EXPECT_EQ(value, 7);
+}
+
 TEST(SkiplistTest, DumpLoadTest) {
     BasicSerializer bs;
     Skiplist<int, std::string> list(&bs);
@@ -171,6 +219,2047 @@ TEST(SkiplistTest, DumpLoadTest) {
     EXPECT_EQ(value, "testValue4");
 }
 
+// the heights of the nodes of a list, as written by dump_to
+static std::string dumped_heights(Skiplist<int, std::string>& list, const std::string& path) {
+    list.dump_to(path);
+    std::ifstream in(path);
+    nlohmann::json nodes;
+    in >> nodes;
+    std::string heights;
+    for (auto& node : nodes) {
+        heights += std::to_string((int)node["NODE_HEIGHT"]) + ",";
+    }
+    return heights;
+}
+
+TEST(SkiplistTest, HeightSeedTest) {
+    BasicSerializer bs;
+    Skiplist<int, std::string> list1(&bs);
+    Skiplist<int, std::string> list2(&bs);
+    Skiplist<int, std::string> list3(&bs);
+    list1.seed_height_generator(42);
+    list2.seed_height_generator(42);
+    list3.seed_height_generator(43);
+    // interleaved, each list keeps drawing from its own generator
+    for (int k = 0; k < 1000; k++) {
+        list1.insert(k, "v");
+        list2.insert(k, "v");
+        list3.insert(k, "v");
+    }
+    std::string h1 = dumped_heights(list1, "./output/height_test1.json");
+    EXPECT_EQ(h1, dumped_heights(list2, "./output/height_test2.json"));
+    EXPECT_NE(h1, dumped_heights(list3, "./output/height_test3.json"));
+}
+
+TEST(SkiplistTest, HeightDistributionTest) {
+    // with probability 1/4 per level, and with 1/3 for the generic path
+    for (int pd : {4, 3}) {
+        BasicSerializer bs;
+        Skiplist<int, std::string> list(DEFAULT_MAX_HEIGHT, pd, &bs);
+        const int count = 100000;
+        for (int k = 0; k < count; k++) {
+            list.insert(k, "");
+        }
+        list.dump_to("./output/height_distribution_test.json");
+        std::ifstream in("./output/height_distribution_test.json");
+        nlohmann::json nodes;
+        in >> nodes;
+        std::vector<int> at_least(DEFAULT_MAX_HEIGHT + 1, 0);
+        for (auto& node : nodes) {
+            int h = node["NODE_HEIGHT"];
+            ASSERT_GE(h, 1);
+            ASSERT_LE(h, DEFAULT_MAX_HEIGHT);
+            for (int i = 1; i <= h; i++) {
+                at_least[i]++;
+            }
+        }
+        double expected = count;
+        for (int i = 1; i <= 4; i++) {
+            EXPECT_NEAR(at_least[i], expected, expected * 0.1 + 50);
+            expected /= pd;
+        }
+    }
+}
+
+TEST(SkiplistTest, ConcurrentInsertTest) {
+    Skiplist<int, int> list(nullptr);
+    const int thread_num = 8;
+    const int per_thread = 2000;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < thread_num; t++) {
+        writers.emplace_back([&list, t]() {
+            // interleaved keys make the writers race on the same predecessors
+            for (int i = 0; i < per_thread; i++) {
+                list.insert(i * thread_num + t, t);
+            }
+        });
+    }
+    for (auto& w : writers) {
+        w.join();
+    }
+
+    for (int k = 0; k < thread_num * per_thread; k++) {
+        int value = -1;
+        EXPECT_TRUE(list.read(k, value));
+        EXPECT_EQ(value, k % thread_num);
+    }
+}
+
+TEST(SkiplistTest, ConcurrentUpdateTest) {
+    Skiplist<int, std::string> list(nullptr);
+    const int thread_num = 4;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < thread_num; t++) {
+        writers.emplace_back([&list, t]() {
+            for (int i = 0; i < 1000; i++) {
+                list.insert(i % 10, "value" + std::to_string(t));
+            }
+        });
+    }
+    for (auto& w : writers) {
+        w.join();
+    }
+
+    for (int k = 0; k < 10; k++) {
+        std::string value;
+        EXPECT_TRUE(list.read(k, value));
+        EXPECT_EQ(value.substr(0, 5), "value");
+    }
+}
+
+TEST(SkiplistTest, ConcurrentEraseTest) {
+    Skiplist<int, int> list(nullptr);
+    const int key_num = 5000;
+    for (int k = 0; k < key_num; k++) {
+        list.insert(k, k);
+    }
+
+    // every key is erased by several threads, exactly one of them wins
+    const int thread_num = 4;
+    std::atomic<int> erased(0);
+    std::vector<std::thread> erasers;
+    for (int t = 0; t < thread_num; t++) {
+        erasers.emplace_back([&list, &erased]() {
+            for (int k = 0; k < key_num; k++) {
+                if (list.erase(k)) {
+                    erased++;
+                }
+            }
+        });
+    }
+    for (auto& e : erasers) {
+        e.join();
+    }
+
+    EXPECT_EQ(erased.load(), key_num);
+    for (int k = 0; k < key_num; k++) {
+        int value;
+        EXPECT_FALSE(list.read(k, value));
+    }
+}
+
+TEST(SkiplistTest, ConcurrentInsertEraseTest) {
+    Skiplist<int, int> list(nullptr);
+    const int thread_num = 4;
+    const int key_num = 4000;
+    std::atomic<bool> stop(false);
+    // readers churn through the same range while writers insert and erase
+    std::thread reader([&list, &stop]() {
+        while (!stop.load()) {
+            for (int k = 0; k < key_num; k++) {
+                int value;
+                if (list.read(k, value)) {
+                    EXPECT_EQ(value, k);
+                }
+            }
+        }
+    });
+    std::vector<std::thread> writers;
+    for (int t = 0; t < thread_num; t++) {
+        writers.emplace_back([&list, t]() {
+            // each thread owns the keys k % thread_num == t, but they are neighbours
+            for (int round = 0; round < 5; round++) {
+                for (int k = t; k < key_num; k += thread_num) {
+                    list.insert(k, k);
+                }
+                for (int k = t; k < key_num; k += thread_num) {
+                    if ((k / thread_num) % 2 == round % 2) {
+                        EXPECT_TRUE(list.erase(k));
+                    }
+                }
+            }
+        });
+    }
+    for (auto& w : writers) {
+        w.join();
+    }
+    stop.store(true);
+    reader.join();
+
+    // the last round erased the keys with an even k / thread_num
+    for (int k = 0; k < key_num; k++) {
+        int value;
+        EXPECT_EQ(list.read(k, value), (k / thread_num) % 2 == 1);
+    }
+}
+
+// counts the live instances, to observe when a skiplist frees its values
+struct CountedValue {
+    static std::atomic<int> alive;
+    int v;
+    CountedValue(int x = 0) : v(x) { alive++; }
+    CountedValue(const CountedValue& o) : v(o.v) { alive++; }
+    CountedValue& operator=(const CountedValue& o) = default;
+    ~CountedValue() { alive--; }
+};
+std::atomic<int> CountedValue::alive(0);
+
+struct CopyCounted {
+    static int copies;
+    int v;
+    CopyCounted(int x = 0) : v(x) {}
+    CopyCounted(const CopyCounted& o) : v(o.v) { copies++; }
+    CopyCounted(CopyCounted&& o) : v(o.v) {}
+    CopyCounted& operator=(const CopyCounted& o) { v = o.v; copies++; return *this; }
+    bool operator<(const CopyCounted& o) const { return v < o.v; }
+    bool operator==(const CopyCounted& o) const { return v == o.v; }
+    bool operator!=(const CopyCounted& o) const { return v != o.v; }
+};
+int CopyCounted::copies = 0;
+
+TEST(SkiplistTest, MoveInsertTest) {
+    Skiplist<CopyCounted, CopyCounted> list(nullptr);
+    CopyCounted::copies = 0;
+    for (int k = 0; k < 1000; k++) {
+        list.insert(CopyCounted(k), CopyCounted(k));
+    }
+    // replace the values, the moved node of a lost race is moved again
+    for (int k = 0; k < 1000; k++) {
+        list.insert(CopyCounted(k), CopyCounted(k + 1));
+    }
+    EXPECT_EQ(CopyCounted::copies, 0);
+    CopyCounted value;
+    EXPECT_TRUE(list.read(CopyCounted(10), value));
+    EXPECT_EQ(value.v, 11);
+}
+
+TEST(SkiplistTest, EmplaceTest) {
+    Skiplist<int, std::string> list(nullptr);
+    list.emplace(1, 3, 'a');
+    list.emplace(2, "bb");
+    std::string value;
+    EXPECT_TRUE(list.read(1, value));
+    EXPECT_EQ(value, "aaa");
+    list.emplace(1, 2, 'c');
+    EXPECT_TRUE(list.read(1, value));
+    EXPECT_EQ(value, "cc");
+    EXPECT_TRUE(list.read(2, value));
+    EXPECT_EQ(value, "bb");
+}
+
+TEST(SkiplistTest, InsertAllocationTest) {
+    const int count = 10000;
+    {
+        // the node is the only allocation of an insert
+        Skiplist<int, int, EpochReclamation> list(nullptr);
+        list.insert(-1, 0);
+        long before = allocations.load();
+        for (int k = 0; k < count; k++) {
+            list.insert(k, k);
+        }
+        EXPECT_EQ(allocations.load() - before, count);
+        // and erase allocates nothing
+        before = allocations.load();
+        for (int k = 0; k < count; k++) {
+            list.erase(k);
+        }
+        EXPECT_EQ(allocations.load() - before, 0);
+    }
+    {
+        // nodes come from the arena
+        Skiplist<int, int> list(nullptr);
+        long before = allocations.load();
+        for (int k = 0; k < count; k++) {
+            list.insert(k, k);
+        }
+        EXPECT_EQ(allocations.load() - before, 0);
+    }
+}
+
+TEST(SkiplistTest, IteratorTest) {
+    Skiplist<int, std::string> list(nullptr);
+    Skiplist<int, std::string>::Iterator empty(&list);
+    empty.seek_to_first();
+    EXPECT_FALSE(empty.valid());
+
+    for (int k = 0; k < 100; k += 2) {
+        list.insert(k, std::to_string(k));
+    }
+    Skiplist<int, std::string>::Iterator it(&list);
+    it.seek_to_first();
+    int expected = 0;
+    for (; it.valid(); it.next()) {
+        EXPECT_EQ(it.key(), expected);
+        EXPECT_EQ(it.value(), std::to_string(expected));
+        expected += 2;
+    }
+    EXPECT_EQ(expected, 100);
+
+    it.seek(31);
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), 32);
+    it.seek(40);
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), 40);
+    it.seek(99);
+    EXPECT_FALSE(it.valid());
+}
+
+TEST(SkiplistTest, ScanTest) {
+    Skiplist<int, int> list(nullptr);
+    for (int k = 0; k < 10000; k++) {
+        list.insert(k, k * 2);
+    }
+    std::vector<int> keys;
+    size_t n = list.scan(1000, 2000, 10000, [&keys](const int& k, const int& v) {
+        EXPECT_EQ(v, k * 2);
+        keys.push_back(k);
+    });
+    EXPECT_EQ(n, 1000u);
+    ASSERT_EQ(keys.size(), 1000u);
+    EXPECT_EQ(keys.front(), 1000);
+    EXPECT_EQ(keys.back(), 1999);
+
+    n = list.scan(9990, 20000, 5, [](const int&, const int&) {});
+    EXPECT_EQ(n, 5u);
+    n = list.scan(9990, 20000, 100, [](const int&, const int&) {});
+    EXPECT_EQ(n, 10u);
+    n = list.scan(20000, 30000, 100, [](const int&, const int&) {});
+    EXPECT_EQ(n, 0u);
+}
+
+// the tests that run once with each reclaimer
+template<class Reclaimer>
+class AllReclaimersTest : public testing::Test {};
+using Reclaimers = testing::Types<NoReclamation, EpochReclamation, HazardPointerReclamation>;
+TYPED_TEST_SUITE(AllReclaimersTest, Reclaimers);
+
+// iterate while a writer inserts and erases the odd keys,
+// the even keys stay and must always be seen in order
+TYPED_TEST(AllReclaimersTest, ConcurrentIteratorTest) {
+    Skiplist<int, int, TypeParam> list(nullptr);
+    const int count = 2000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, k);
+    }
+    std::atomic<bool> stop(false);
+    std::thread writer([&list, &stop]() {
+        for (int i = 0; !stop.load(); i++) {
+            int k = (i * 7 % count) | 1;
+            list.insert(k, k);
+            list.erase(((i * 13) % count) | 1);
+        }
+    });
+    for (int round = 0; round < 50; round++) {
+        typename Skiplist<int, int, TypeParam>::Iterator it(&list);
+        int evens = 0;
+        int last = -1;
+        for (it.seek_to_first(); it.valid(); it.next()) {
+            EXPECT_GT(it.key(), last);
+            EXPECT_EQ(it.value(), it.key());
+            last = it.key();
+            if (last % 2 == 0) {
+                evens++;
+            }
+        }
+        EXPECT_EQ(evens, count / 2);
+    }
+    stop.store(true);
+    writer.join();
+}
+
+TEST(SkiplistTest, ReadBatchTest) {
+    Skiplist<int, std::string> list(nullptr);
+    const int count = 1000;
+    for (int k = 0; k < count; k += 3) {
+        list.insert(k, std::to_string(k));
+    }
+    // fewer keys than interleaved lookups, and many more
+    for (int n : {0, 1, 5, 1000}) {
+        std::vector<int> keys;
+        std::mt19937 gen(n);
+        for (int i = 0; i < n; i++) {
+            keys.push_back(gen() % (count + 10));
+        }
+        std::vector<std::string> values(n);
+        std::unique_ptr<bool[]> found(new bool[n + 1]);
+        size_t found_num = list.read_batch(keys.data(), n, values.data(), found.get());
+        size_t expected_num = 0;
+        for (int i = 0; i < n; i++) {
+            std::string value;
+            bool expected = list.read(keys[i], value);
+            EXPECT_EQ(found[i], expected);
+            if (expected) {
+                EXPECT_EQ(values[i], value);
+                expected_num++;
+            }
+        }
+        EXPECT_EQ(found_num, expected_num);
+    }
+}
+
+TYPED_TEST(AllReclaimersTest, SortedReadBatchTest) {
+    Skiplist<std::string, int, TypeParam> list(nullptr);
+    const int count = 20000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(std::to_string(k), k);
+    }
+    std::mt19937 gen(7);
+    for (int round = 0; round < 200; round++) {
+        // dense keys of a small range, far ones, repeated ones, in any order
+        std::vector<std::string> keys;
+        int base = gen() % count;
+        int n = gen() % 100;
+        for (int i = 0; i < n; i++) {
+            int k = (round % 4 == 0) ? gen() % (count + 10) : base + gen() % 200;
+            keys.push_back(std::to_string(k));
+        }
+        if (round % 3 == 0) {
+            std::sort(keys.begin(), keys.end());
+        } else if (round % 3 == 1) {
+            std::sort(keys.rbegin(), keys.rend());
+        }
+        // the values of absent keys are left as they are
+        std::vector<int> values(n, -1);
+        std::unique_ptr<bool[]> found(new bool[n + 1]);
+        size_t found_num = list.read_batch(keys.data(), n, values.data(), found.get());
+        size_t expected_num = 0;
+        for (int i = 0; i < n; i++) {
+            int value;
+            bool expected = list.read(keys[i], value);
+            EXPECT_EQ(found[i], expected);
+            EXPECT_EQ(values[i], expected ? value : -1);
+            expected_num += expected;
+        }
+        EXPECT_EQ(found_num, expected_num);
+    }
+}
+
+TYPED_TEST(AllReclaimersTest, ConcurrentReadBatchTest) {
+    Skiplist<int, int, TypeParam> list(nullptr);
+    const int count = 2000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, k);
+    }
+    std::atomic<bool> stop(false);
+    std::thread writer([&list, &stop]() {
+        for (int i = 0; !stop.load(); i++) {
+            int k = (i * 7 % count) | 1;
+            list.insert(k, k);
+            list.erase(((i * 13) % count) | 1);
+        }
+    });
+    std::vector<int> keys(count);
+    for (int k = 0; k < count; k++) {
+        keys[k] = (k * 1237) % count;
+    }
+    std::vector<int> values(count);
+    std::unique_ptr<bool[]> found(new bool[count]);
+    for (int round = 0; round < 20; round++) {
+        list.read_batch(keys.data(), count, values.data(), found.get());
+        for (int i = 0; i < count; i++) {
+            // the even keys are never erased, the odd ones come and go
+            if (keys[i] % 2 == 0) {
+                EXPECT_TRUE(found[i]);
+            }
+            if (found[i]) {
+                EXPECT_EQ(values[i], keys[i]);
+            }
+        }
+    }
+    stop.store(true);
+    writer.join();
+}
+
+#ifdef SKIPLIST_HAS_COROUTINES
+TEST(SkiplistTest, CoroutineReadBatchTest) {
+    Skiplist<int, std::string, HazardPointerReclamation> list(nullptr);
+    const int count = 2000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, std::to_string(k));
+    }
+    std::atomic<bool> stop(false);
+    std::thread writer([&list, &stop]() {
+        for (int i = 0; !stop.load(); i++) {
+            int k = (i * 7 % count) | 1;
+            list.insert(k, std::to_string(k));
+            list.erase(((i * 13) % count) | 1);
+        }
+    });
+    std::vector<int> keys(count);
+    for (int k = 0; k < count; k++) {
+        keys[k] = (k * 1237) % count;
+    }
+    for (int width : {1, 3, 8, 100}) {
+        std::vector<std::optional<std::string>> values(count, std::string("stale"));
+        size_t found_num = list.read_batch_coroutines(keys, values, width);
+        size_t expected_num = 0;
+        for (int i = 0; i < count; i++) {
+            // the even keys are never erased, the odd ones come and go
+            if (keys[i] % 2 == 0) {
+                EXPECT_TRUE(values[i].has_value());
+            }
+            if (values[i]) {
+                EXPECT_EQ(*values[i], std::to_string(keys[i]));
+                expected_num++;
+            }
+        }
+        EXPECT_EQ(found_num, expected_num);
+    }
+    stop.store(true);
+    writer.join();
+
+    std::vector<std::optional<std::string>> values(1);
+    EXPECT_EQ(list.read_batch_coroutines(std::span<const int>(), values), 0u);
+}
+#endif
+
+template<class Key>
+void entry_table_test(const std::vector<Key>& keys,
+                      typename Skiplist<Key, Key>::EntryLayer layer = Skiplist<Key, Key>::ENTRY_TABLE_LAYER) {
+    Skiplist<Key, Key> list(nullptr);
+    list.set_entry_layer(layer);
+    std::map<Key, Key> expected;
+    std::mt19937 gen(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        list.insert(keys[i], keys[i]);
+        expected[keys[i]] = keys[i];
+        // erase some nodes the entry table may point to
+        if (i % 5 == 4) {
+            Key k = keys[gen() % (i + 1)];
+            list.erase(k);
+            expected.erase(k);
+        }
+        if (i % 97 == 0) {
+            for (size_t j = 0; j <= i; j++) {
+                Key value;
+                bool found = list.read(keys[j], value);
+                ASSERT_EQ(found, expected.count(keys[j]) > 0);
+                if (found) {
+                    ASSERT_EQ(value, keys[j]);
+                }
+            }
+        }
+    }
+    // scans are left alone
+    typename Skiplist<Key, Key>::Iterator it(&list);
+    it.seek_to_first();
+    for (auto& kv : expected) {
+        ASSERT_TRUE(it.valid());
+        EXPECT_EQ(it.key(), kv.first);
+        it.next();
+    }
+    EXPECT_FALSE(it.valid());
+}
+
+TEST(SkiplistTest, EntryTableTest) {
+    std::mt19937 gen(7);
+    // dense keys, negative keys and keys spread over the whole type
+    std::vector<int> dense(3000);
+    for (int i = 0; i < 3000; i++) {
+        dense[i] = (i * 1237) % 3000;
+    }
+    entry_table_test(dense);
+    std::vector<int> negative(3000);
+    for (int i = 0; i < 3000; i++) {
+        negative[i] = -int(gen() % 10000);
+    }
+    negative.push_back(INT_MIN);
+    negative.push_back(INT_MAX);
+    entry_table_test(negative);
+    std::vector<uint64_t> sparse = {0, UINT64_MAX, 1, UINT64_MAX - 1};
+    for (int i = 0; i < 3000; i++) {
+        sparse.push_back((uint64_t(gen()) << 32) | gen());
+    }
+    entry_table_test(sparse);
+    std::vector<long long> wide = {LLONG_MIN, LLONG_MAX};
+    for (int i = 0; i < 3000; i++) {
+        wide.push_back(((long long)(gen()) << 32) | gen());
+    }
+    entry_table_test(wide);
+}
+
+TEST(SkiplistTest, EntryTableExtremeKeyTest) {
+    // a low list and a small probability denominator give a table of two
+    // buckets, the first one starts below INT_MIN then, try many heights
+    for (uint64_t seed = 1; seed <= 200; seed++) {
+        for (int pd : {2, 3}) {
+            Skiplist<int, int> list(32, pd, nullptr);
+            list.seed_height_generator(seed);
+            list.insert(INT_MIN, 0);
+            list.insert(INT_MAX, 1);
+            int value;
+            ASSERT_TRUE(list.read(INT_MIN, value));
+            EXPECT_EQ(value, 0);
+            ASSERT_TRUE(list.read(INT_MAX, value));
+            EXPECT_EQ(value, 1);
+
+            Skiplist<int, int> loaded(32, pd, nullptr);
+            loaded.seed_height_generator(seed);
+            std::vector<std::pair<int, int>> pairs = {{INT_MIN, 0}, {-5, 1}, {3, 2}, {INT_MAX, 3}};
+            loaded.bulk_load(pairs.begin(), pairs.end());
+            for (auto& kv : pairs) {
+                ASSERT_TRUE(loaded.read(kv.first, value));
+                EXPECT_EQ(value, kv.second);
+            }
+        }
+    }
+}
+
+TEST(SkiplistTest, LearnedLayerTest) {
+    typedef Skiplist<long long, long long> List;
+    std::mt19937 gen(11);
+    // appended timestamps with jitter, and random keys
+    std::vector<long long> appended;
+    for (int i = 0; i < 5000; i++) {
+        appended.push_back(1650000000000LL + i * 1000LL + gen() % 1000);
+    }
+    entry_table_test(appended, List::LEARNED_LAYER);
+    entry_table_test(appended, List::NO_ENTRY_LAYER);
+    std::vector<long long> random = {LLONG_MIN, LLONG_MAX};
+    for (int i = 0; i < 3000; i++) {
+        random.push_back(((long long)(gen()) << 32) | gen());
+    }
+    entry_table_test(random, List::LEARNED_LAYER);
+    std::vector<int> negative(3000);
+    for (int i = 0; i < 3000; i++) {
+        negative[i] = -int(gen() % 10000);
+    }
+    entry_table_test(negative, Skiplist<int, int>::LEARNED_LAYER);
+
+    // switching layers on a filled list
+    Skiplist<int, int> list(nullptr);
+    for (int k = 0; k < 10000; k += 2) {
+        list.insert(k, k);
+    }
+    for (auto layer : {Skiplist<int, int>::LEARNED_LAYER, Skiplist<int, int>::NO_ENTRY_LAYER,
+                       Skiplist<int, int>::ENTRY_TABLE_LAYER, Skiplist<int, int>::LEARNED_LAYER}) {
+        list.set_entry_layer(layer);
+        for (int k = -1; k <= 10000; k++) {
+            int value = -1;
+            ASSERT_EQ(list.read(k, value), (k >= 0) && (k < 10000) && (k % 2 == 0));
+        }
+    }
+}
+
+TEST(SkiplistTest, ConcurrentLearnedLayerTest) {
+    Skiplist<int, int> list(nullptr);
+    list.set_entry_layer(Skiplist<int, int>::LEARNED_LAYER);
+    const int count = 20000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, k);
+    }
+    std::atomic<bool> stop(false);
+    // the odd keys come and go, and the list grows at its end
+    std::thread writer([&list, &stop]() {
+        for (int i = 0; !stop.load(); i++) {
+            int k = (i * 7 % count) | 1;
+            list.insert(k, k);
+            list.erase(((i * 13) % count) | 1);
+            list.insert(count + i, count + i);
+        }
+    });
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; t++) {
+        readers.emplace_back([&list, t]() {
+            for (int i = 0; i < 3 * count; i++) {
+                int k = ((i + t) * 1237 % count) & ~1;
+                int value = -1;
+                EXPECT_TRUE(list.read(k, value));
+                EXPECT_EQ(value, k);
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    stop.store(true);
+    writer.join();
+}
+
+TEST(SkiplistTest, ConcurrentEntryTableTest) {
+    Skiplist<int, int> list(nullptr);
+    const int count = 20000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, k);
+    }
+    std::atomic<bool> stop(false);
+    // the odd keys come and go, and the list grows at its end
+    std::thread writer([&list, &stop]() {
+        for (int i = 0; !stop.load(); i++) {
+            int k = (i * 7 % count) | 1;
+            list.insert(k, k);
+            list.erase(((i * 13) % count) | 1);
+            list.insert(count + i, count + i);
+        }
+    });
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; t++) {
+        readers.emplace_back([&list, t]() {
+            for (int i = 0; i < 3 * count; i++) {
+                int k = ((i + t) * 1237 % count) & ~1;
+                int value = -1;
+                EXPECT_TRUE(list.read(k, value));
+                EXPECT_EQ(value, k);
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    stop.store(true);
+    writer.join();
+}
+
+template<class Compare>
+void top_index_test() {
+    Skiplist<int, std::string, NoReclamation, NoAugmentation, Compare> list(nullptr);
+    const int count = 20000;
+    std::mt19937 gen(3);
+    std::set<int> expected;
+    auto check = [&list, &expected]() {
+        for (int k = -1; k <= count; k++) {
+            std::string value;
+            bool found = list.read(k, value);
+            ASSERT_EQ(found, expected.count(k) > 0);
+            if (found) {
+                ASSERT_EQ(value, std::to_string(k));
+            }
+        }
+    };
+    // an empty snapshot first
+    list.rebuild_top_index();
+    for (int i = 0; i < count; i++) {
+        int k = gen() % count;
+        list.insert(k, std::to_string(k));
+        expected.insert(k);
+    }
+    check();
+    list.rebuild_top_index();
+    check();
+    // nodes of the snapshot are erased and inserted again
+    for (int i = 0; i < count / 2; i++) {
+        int k = gen() % count;
+        list.erase(k);
+        expected.erase(k);
+        if (i % 2 == 0) {
+            k = gen() % count;
+            list.insert(k, std::to_string(k));
+            expected.insert(k);
+        }
+    }
+    check();
+    list.rebuild_top_index();
+    check();
+}
+
+TEST(SkiplistTest, TopIndexTest) {
+    top_index_test<std::less<>>();
+    top_index_test<std::greater<int>>();
+
+    // keys other than integers only use the top level index
+    Skiplist<std::string, int> list(nullptr);
+    for (int k = 0; k < 5000; k += 2) {
+        list.insert(std::to_string(k), k);
+    }
+    list.rebuild_top_index();
+    for (int k = 0; k < 5000; k++) {
+        int value = -1;
+        EXPECT_EQ(list.read(std::to_string(k), value), k % 2 == 0);
+        EXPECT_EQ(value, k % 2 == 0 ? k : -1);
+    }
+}
+
+TEST(SkiplistTest, ConcurrentTopIndexTest) {
+    Skiplist<std::string, int> list(nullptr);
+    const int count = 20000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(std::to_string(k), k);
+    }
+    list.start_top_index(std::chrono::milliseconds(1));
+    std::atomic<bool> stop(false);
+    // the odd keys come and go, the even ones are erased and inserted again
+    std::thread writer([&list, &stop]() {
+        for (int i = 0; !stop.load(); i++) {
+            int k = (i * 7 % count) | 1;
+            list.insert(std::to_string(k), k);
+            list.erase(std::to_string(((i * 13) % count) | 1));
+            if (i % 16 == 0) {
+                k = (i * 11 % count) & ~1;
+                list.erase(std::to_string(k));
+                list.insert(std::to_string(k), k);
+            }
+        }
+    });
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; t++) {
+        readers.emplace_back([&list, t]() {
+            for (int i = 0; i < 3 * count; i++) {
+                int k = ((i + t) * 1237 % count) | 1;
+                int value = -1;
+                if (list.read(std::to_string(k), value)) {
+                    EXPECT_EQ(value, k);
+                }
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    stop.store(true);
+    writer.join();
+    list.stop_top_index();
+    list.stop_top_index();
+
+    for (int k = 0; k < count; k += 2) {
+        int value = -1;
+        EXPECT_TRUE(list.read(std::to_string(k), value));
+        EXPECT_EQ(value, k);
+    }
+}
+
+// mostly appended keys, some a little or far behind, and erases of the last one
+TYPED_TEST(AllReclaimersTest, AppendTest) {
+    Skiplist<int, int, TypeParam> list(nullptr);
+    std::set<int> expected;
+    std::mt19937 gen(5);
+    for (int i = 0; i < 20000; i++) {
+        int k = i * 4;
+        int r = gen() % 8;
+        if (r == 0) {
+            k -= gen() % 64;
+        } else if (r == 1) {
+            k = gen() % (i * 4 + 1);
+        }
+        list.insert(k, k);
+        expected.insert(k);
+        if (i % 7 == 0) {
+            int last = *expected.rbegin();
+            EXPECT_TRUE(list.erase(last));
+            expected.erase(last);
+        }
+    }
+    typename Skiplist<int, int, TypeParam>::Iterator it(&list);
+    it.seek_to_first();
+    for (int k : expected) {
+        ASSERT_TRUE(it.valid());
+        EXPECT_EQ(it.key(), k);
+        EXPECT_EQ(it.value(), k);
+        it.next();
+    }
+    EXPECT_FALSE(it.valid());
+    for (int k = -1; k <= 80000; k++) {
+        int value;
+        ASSERT_EQ(list.read(k, value), expected.count(k) > 0);
+    }
+}
+
+// writers appending interleaved keys, each erasing some of its own
+TYPED_TEST(AllReclaimersTest, ConcurrentAppendTest) {
+    Skiplist<int, int, TypeParam> list(nullptr);
+    const int thread_num = 4;
+    const int count = 20000;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < thread_num; t++) {
+        writers.emplace_back([&list, t]() {
+            for (int i = 0; i < count; i++) {
+                int k = i * thread_num + t;
+                list.insert(k, k);
+                if (i % 5 == 0) {
+                    EXPECT_TRUE(list.erase(k));
+                }
+            }
+        });
+    }
+    for (auto& w : writers) {
+        w.join();
+    }
+    typename Skiplist<int, int, TypeParam>::Iterator it(&list);
+    it.seek_to_first();
+    for (int k = 0; k < count * thread_num; k++) {
+        if ((k / thread_num) % 5 == 0) {
+            continue;
+        }
+        ASSERT_TRUE(it.valid());
+        ASSERT_EQ(it.key(), k);
+        it.next();
+    }
+    EXPECT_FALSE(it.valid());
+}
+
+// appends while erasers empty the list behind them, so the list height
+// keeps dropping between an append raising it and linking the new node
+TYPED_TEST(AllReclaimersTest, ConcurrentAppendEraseTest) {
+    Skiplist<int, int, TypeParam> list(32, 2, nullptr);
+    const int thread_num = 3;
+    const int count = 60000;
+    std::unique_ptr<std::atomic<bool>[]> inserted(new std::atomic<bool>[count]);
+    for (int k = 0; k < count; k++) {
+        inserted[k].store(false);
+    }
+    std::atomic<int> next_insert(0);
+    std::atomic<int> next_erase(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_num; t++) {
+        threads.emplace_back([&]() {
+            for (int k = next_insert++; k < count; k = next_insert++) {
+                list.insert(k, k);
+                inserted[k].store(true);
+            }
+        });
+        threads.emplace_back([&]() {
+            for (int k = next_erase++; k < count; k = next_erase++) {
+                while (!inserted[k].load()) {
+                    std::this_thread::yield();
+                }
+                EXPECT_TRUE(list.erase(k));
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    typename Skiplist<int, int, TypeParam>::Iterator it(&list);
+    it.seek_to_first();
+    EXPECT_FALSE(it.valid());
+    list.insert(count, count);
+    int value;
+    EXPECT_TRUE(list.read(count, value));
+}
+
+TEST(SkiplistTest, FingerSearchTest) {
+    // lists sharing the finger cache of the thread
+    const int list_num = FINGER_CACHE_SIZE + 1;
+    std::vector<std::unique_ptr<Skiplist<int, int>>> lists;
+    std::vector<std::map<int, int>> expected(list_num);
+    for (int i = 0; i < list_num; i++) {
+        lists.emplace_back(new Skiplist<int, int>(nullptr));
+        lists[i]->set_finger_search(true);
+    }
+    std::mt19937 gen(9);
+    int k = 0;
+    for (int i = 0; i < 100000; i++) {
+        // mostly short steps in both directions, sometimes a jump
+        int r = gen() % 16;
+        k = r == 0 ? int(gen() % 20000) : std::max(0, k + int(gen() % 41) - 20);
+        int l = (i / 100) % list_num;
+        int op = gen() % 4;
+        if (op == 0) {
+            lists[l]->insert(k, i);
+            expected[l][k] = i;
+        } else if (op == 1) {
+            ASSERT_EQ(lists[l]->erase(k), expected[l].erase(k) > 0);
+        } else {
+            int value;
+            bool found = lists[l]->read(k, value);
+            ASSERT_EQ(found, expected[l].count(k) > 0);
+            if (found) {
+                ASSERT_EQ(value, expected[l][k]);
+            }
+        }
+    }
+    for (int l = 0; l < list_num; l++) {
+        Skiplist<int, int>::Iterator it(lists[l].get());
+        it.seek_to_first();
+        for (auto& kv : expected[l]) {
+            ASSERT_TRUE(it.valid());
+            EXPECT_EQ(it.key(), kv.first);
+            EXPECT_EQ(it.value(), kv.second);
+            it.next();
+        }
+        EXPECT_FALSE(it.valid());
+    }
+}
+
+TEST(SkiplistTest, ConcurrentFingerSearchTest) {
+    Skiplist<int, int> list(nullptr);
+    list.set_finger_search(true);
+    const int thread_num = 4;
+    const int count = 20000;
+    for (int k = 0; k < count * thread_num; k += 2) {
+        list.insert(k, k);
+    }
+    // each thread walks its own range, inserting and erasing the odd keys,
+    // and reads the even ones of the next range, that the fingers pass through
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_num; t++) {
+        threads.emplace_back([&list, t]() {
+            int base = t * count;
+            int other = ((t + 1) % thread_num) * count;
+            for (int round = 0; round < 3; round++) {
+                for (int i = 1; i < count; i += 2) {
+                    list.insert(base + i, base + i);
+                    int value = -1;
+                    EXPECT_TRUE(list.read(other + i - 1, value));
+                    EXPECT_EQ(value, other + i - 1);
+                    if (i > 20) {
+                        EXPECT_TRUE(list.erase(base + i - 20));
+                    }
+                }
+                for (int i = count - 19; i < count; i += 2) {
+                    EXPECT_TRUE(list.erase(base + i));
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    Skiplist<int, int>::Iterator it(&list);
+    it.seek_to_first();
+    for (int k = 0; k < count * thread_num; k += 2) {
+        ASSERT_TRUE(it.valid());
+        ASSERT_EQ(it.key(), k);
+        it.next();
+    }
+    EXPECT_FALSE(it.valid());
+}
+
+// a sorted load into the empty list, then sorted runs that fall
+// between, onto and behind the keys of the list, then unsorted input
+template<class Reclaimer, class Augment>
+void bulk_load_test() {
+    typedef Skiplist<int, int, Reclaimer, Augment> List;
+    List list(nullptr);
+    std::map<int, int> expected;
+    std::vector<std::pair<int, int>> pairs;
+    for (int k = 0; k < 20000; k += 2) {
+        pairs.emplace_back(k, k);
+        expected[k] = k;
+    }
+    list.bulk_load(pairs.begin(), pairs.end());
+
+    pairs.clear();
+    for (int k = 1; k < 30000; k += (k < 5000) ? 6 : 3) {
+        pairs.emplace_back(k, -k);
+        expected[k] = -k;
+    }
+    list.bulk_load(pairs.begin(), pairs.end());
+
+    {
+        typename List::SortedBuilder builder(&list);
+        std::mt19937 gen(3);
+        for (int i = 0; i < 5000; i++) {
+            int k = gen() % 40000;
+            builder.add(k, i, 1 + i % 4);
+            expected[k] = i;
+        }
+        builder.publish();
+        EXPECT_EQ(builder.size(), 0u);
+        // never published, so never seen
+        builder.add(-1, -1);
+    }
+
+    typename List::Iterator it(&list);
+    it.seek_to_first();
+    for (auto& kv : expected) {
+        ASSERT_TRUE(it.valid());
+        ASSERT_EQ(it.key(), kv.first);
+        ASSERT_EQ(it.value(), kv.second);
+        it.next();
+    }
+    EXPECT_FALSE(it.valid());
+    for (int k = -1; k <= 40000; k++) {
+        int value;
+        ASSERT_EQ(list.read(k, value), expected.count(k) > 0);
+    }
+    if constexpr (Augment::kEnabled) {
+        size_t i = 0;
+        for (auto& kv : expected) {
+            ASSERT_EQ(list.rank(kv.first), i++);
+        }
+    }
+}
+
+TEST(SkiplistTest, BulkLoadTest) {
+    bulk_load_test<NoReclamation, NoAugmentation>();
+    bulk_load_test<EpochReclamation, NoAugmentation>();
+    bulk_load_test<HazardPointerReclamation, NoAugmentation>();
+    bulk_load_test<NoReclamation, IndexAugmentation>();
+}
+
+// loaders publish runs of their own interleaved keys and erase some of them
+// while other writers insert and erase keys in between, a reader that
+// sees the last key of a load into the empty list sees the first one
+TYPED_TEST(AllReclaimersTest, ConcurrentBulkLoadTest) {
+    Skiplist<int, int, TypeParam> list(nullptr);
+    const int count = 20000;
+    std::atomic<bool> stop(false);
+    std::thread reader([&list, &stop]() {
+        while (!stop.load()) {
+            int value;
+            if (list.read(count * 4 - 4, value)) {
+                EXPECT_TRUE(list.read(0, value));
+            }
+        }
+    });
+    std::vector<std::pair<int, int>> first;
+    for (int k = 0; k < count * 4; k += 4) {
+        first.emplace_back(k, k);
+    }
+    list.bulk_load(first.begin(), first.end());
+    stop.store(true);
+    reader.join();
+
+    std::vector<std::thread> writers;
+    for (int t = 1; t < 4; t++) {
+        writers.emplace_back([&list, t]() {
+            std::vector<std::pair<int, int>> run;
+            for (int i = 0; i < count; i++) {
+                int k = i * 4 + t;
+                if (t == 3) {
+                    list.insert(k, k);
+                    if (i % 3 == 0) {
+                        EXPECT_TRUE(list.erase(k));
+                    }
+                    continue;
+                }
+                run.emplace_back(k, k);
+                if (run.size() == 256) {
+                    list.bulk_load(run.begin(), run.end());
+                    for (auto& kv : run) {
+                        if (kv.first % 5 == 0) {
+                            EXPECT_TRUE(list.erase(kv.first));
+                        }
+                    }
+                    run.clear();
+                }
+            }
+            list.bulk_load(run.begin(), run.end());
+            for (auto& kv : run) {
+                if (kv.first % 5 == 0) {
+                    EXPECT_TRUE(list.erase(kv.first));
+                }
+            }
+        });
+    }
+    for (auto& w : writers) {
+        w.join();
+    }
+    typename Skiplist<int, int, TypeParam>::Iterator it(&list);
+    it.seek_to_first();
+    for (int k = 0; k < count * 4; k++) {
+        int t = k % 4;
+        if (((t == 1 || t == 2) && (k % 5 == 0)) || ((t == 3) && ((k / 4) % 3 == 0))) {
+            continue;
+        }
+        ASSERT_TRUE(it.valid());
+        ASSERT_EQ(it.key(), k);
+        ASSERT_EQ(it.value(), k);
+        it.next();
+    }
+    EXPECT_FALSE(it.valid());
+}
+
+// random batches with repeated keys, onto keys of the list and between them
+template<class Reclaimer, class Augment>
+void insert_batch_test() {
+    typedef Skiplist<int, int, Reclaimer, Augment> List;
+    List list(nullptr);
+    std::map<int, int> expected;
+    std::mt19937 gen(11);
+    int value = 0;
+    for (int size : {1, 2, 16, 256, 4096}) {
+        for (int round = 0; round < 4; round++) {
+            std::vector<std::pair<int, int>> batch;
+            for (int i = 0; i < size; i++) {
+                batch.emplace_back(gen() % 20000, value);
+                expected[batch.back().first] = value++;
+            }
+            list.insert_batch(batch.data(), batch.size());
+            for (int i = 0; i < size; i += 3) {
+                int k = gen() % 20000;
+                ASSERT_EQ(list.erase(k), expected.erase(k) > 0);
+            }
+        }
+    }
+    list.insert_batch(nullptr, 0);
+
+    typename List::Iterator it(&list);
+    it.seek_to_first();
+    for (auto& kv : expected) {
+        ASSERT_TRUE(it.valid());
+        ASSERT_EQ(it.key(), kv.first);
+        ASSERT_EQ(it.value(), kv.second);
+        it.next();
+    }
+    EXPECT_FALSE(it.valid());
+    if constexpr (Augment::kEnabled) {
+        size_t i = 0;
+        for (auto& kv : expected) {
+            ASSERT_EQ(list.rank(kv.first), i++);
+        }
+    }
+}
+
+TEST(SkiplistTest, InsertBatchTest) {
+    insert_batch_test<NoReclamation, NoAugmentation>();
+    insert_batch_test<EpochReclamation, NoAugmentation>();
+    insert_batch_test<HazardPointerReclamation, NoAugmentation>();
+    insert_batch_test<NoReclamation, IndexAugmentation>();
+}
+
+// writers insert batches of their own keys and erase some of them,
+// then one writer appends shuffled batches of consecutive keys,
+// a reader seeing the last key of such a batch sees the first one
+TYPED_TEST(AllReclaimersTest, ConcurrentInsertBatchTest) {
+    Skiplist<int, int, TypeParam> list(nullptr);
+    const int thread_num = 4;
+    const int count = 20000;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < thread_num; t++) {
+        writers.emplace_back([&list, t]() {
+            std::mt19937 gen(t);
+            std::vector<std::pair<int, int>> batch;
+            for (int i = 0; i < count; i++) {
+                int k = i * thread_num + t;
+                batch.emplace_back(k, k);
+                if (batch.size() == size_t(1 + i % 64)) {
+                    std::shuffle(batch.begin(), batch.end(), gen);
+                    list.insert_batch(batch.data(), batch.size());
+                    for (auto& kv : batch) {
+                        if (kv.first % 7 == 0) {
+                            EXPECT_TRUE(list.erase(kv.first));
+                        }
+                    }
+                    batch.clear();
+                }
+            }
+            list.insert_batch(batch.data(), batch.size());
+            for (auto& kv : batch) {
+                if (kv.first % 7 == 0) {
+                    EXPECT_TRUE(list.erase(kv.first));
+                }
+            }
+        });
+    }
+    for (auto& w : writers) {
+        w.join();
+    }
+    typename Skiplist<int, int, TypeParam>::Iterator it(&list);
+    it.seek_to_first();
+    for (int k = 0; k < count * thread_num; k++) {
+        if (k % 7 == 0) {
+            continue;
+        }
+        ASSERT_TRUE(it.valid());
+        ASSERT_EQ(it.key(), k);
+        it.next();
+    }
+    EXPECT_FALSE(it.valid());
+
+    const int base = count * thread_num;
+    std::atomic<bool> stop(false);
+    std::thread reader([&list, &stop, base]() {
+        while (!stop.load()) {
+            for (int b = 0; b < 100; b++) {
+                int value;
+                if (list.read(base + b * 100 + 99, value)) {
+                    EXPECT_TRUE(list.read(base + b * 100, value));
+                }
+            }
+        }
+    });
+    std::mt19937 gen(7);
+    for (int b = 0; b < 100; b++) {
+        std::vector<std::pair<int, int>> batch;
+        for (int k = base + b * 100; k < base + b * 100 + 100; k++) {
+            batch.emplace_back(k, k);
+        }
+        std::shuffle(batch.begin(), batch.end(), gen);
+        list.insert_batch(batch.data(), batch.size());
+    }
+    stop.store(true);
+    reader.join();
+}
+
+TEST(SkiplistTest, BoundTest) {
+    Skiplist<int, std::string> list(nullptr);
+    int found;
+    std::string value;
+    EXPECT_FALSE(list.floor(10, found, value));
+    EXPECT_FALSE(list.find_last(found, value));
+    EXPECT_FALSE(list.lower_bound(10, found, value));
+
+    for (int k = 10; k <= 100; k += 10) {
+        list.insert(k, std::to_string(k));
+    }
+    EXPECT_TRUE(list.floor(35, found, value));
+    EXPECT_EQ(found, 30);
+    EXPECT_EQ(value, "30");
+    EXPECT_TRUE(list.floor(40, found, value));
+    EXPECT_EQ(found, 40);
+    EXPECT_FALSE(list.floor(9, found, value));
+    EXPECT_TRUE(list.floor(1000, found, value));
+    EXPECT_EQ(found, 100);
+
+    EXPECT_TRUE(list.lower_bound(40, found, value));
+    EXPECT_EQ(found, 40);
+    EXPECT_TRUE(list.lower_bound(41, found, value));
+    EXPECT_EQ(found, 50);
+    EXPECT_FALSE(list.lower_bound(101, found, value));
+    EXPECT_TRUE(list.upper_bound(40, found, value));
+    EXPECT_EQ(found, 50);
+    EXPECT_EQ(value, "50");
+    EXPECT_FALSE(list.upper_bound(100, found, value));
+
+    EXPECT_TRUE(list.find_last(found, value));
+    EXPECT_EQ(found, 100);
+    list.erase(100);
+    EXPECT_TRUE(list.find_last(found, value));
+    EXPECT_EQ(found, 90);
+    EXPECT_EQ(value, "90");
+}
+
+TEST(SkiplistTest, ReverseIteratorTest) {
+    Skiplist<int, int> list(nullptr);
+    Skiplist<int, int>::ReverseIterator empty(&list);
+    empty.seek_to_last();
+    EXPECT_FALSE(empty.valid());
+
+    const int count = 100000;
+    for (int k = 0; k < count; k++) {
+        list.insert(k * 2, k);
+    }
+    Skiplist<int, int>::ReverseIterator it(&list);
+    int expected = count - 1;
+    for (it.seek_to_last(); it.valid(); it.next()) {
+        ASSERT_EQ(it.key(), expected * 2);
+        ASSERT_EQ(it.value(), expected);
+        expected--;
+    }
+    EXPECT_EQ(expected, -1);
+
+    // the last 10 pairs at or before 1001
+    it.seek_for_prev(1001);
+    for (int k = 500; k > 490; k--) {
+        ASSERT_TRUE(it.valid());
+        EXPECT_EQ(it.key(), k * 2);
+        it.next();
+    }
+    it.seek_for_prev(1000);
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), 1000);
+    it.seek_for_prev(-1);
+    EXPECT_FALSE(it.valid());
+}
+
+// a descending walk while a writer inserts and erases the odd keys
+TYPED_TEST(AllReclaimersTest, ConcurrentReverseIteratorTest) {
+    Skiplist<int, int, TypeParam> list(nullptr);
+    const int count = 2000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, k);
+    }
+    std::atomic<bool> stop(false);
+    std::thread writer([&list, &stop]() {
+        for (int i = 0; !stop.load(); i++) {
+            int k = (i * 7 % count) | 1;
+            list.insert(k, k);
+            list.erase(((i * 13) % count) | 1);
+        }
+    });
+    for (int round = 0; round < 50; round++) {
+        typename Skiplist<int, int, TypeParam>::ReverseIterator it(&list);
+        int evens = 0;
+        int last = count;
+        for (it.seek_to_last(); it.valid(); it.next()) {
+            EXPECT_LT(it.key(), last);
+            EXPECT_EQ(it.value(), it.key());
+            last = it.key();
+            if (last % 2 == 0) {
+                evens++;
+            }
+        }
+        EXPECT_EQ(evens, count / 2);
+    }
+    stop.store(true);
+    writer.join();
+}
+
+TEST(SkiplistTest, RankSelectTest) {
+    Skiplist<int, int, NoReclamation, IndexAugmentation> list(nullptr);
+    std::set<int> keys;
+    unsigned int seed = 7;
+    for (int i = 0; i < 20000; i++) {
+        int k = rand_r(&seed) % 10000;
+        if (rand_r(&seed) % 3 == 0) {
+            EXPECT_EQ(list.erase(k), keys.erase(k) == 1);
+        } else {
+            list.insert(k, k * 3);
+            keys.insert(k);
+        }
+    }
+    std::vector<int> sorted(keys.begin(), keys.end());
+    for (size_t i = 0; i < sorted.size(); i += 7) {
+        int found, value;
+        ASSERT_TRUE(list.select(i, found, value));
+        EXPECT_EQ(found, sorted[i]);
+        EXPECT_EQ(value, sorted[i] * 3);
+        EXPECT_EQ(list.rank(sorted[i]), i);
+        EXPECT_EQ(list.rank(sorted[i] + 1), i + 1);
+    }
+    int found, value;
+    EXPECT_FALSE(list.select(sorted.size(), found, value));
+    EXPECT_EQ(list.rank(-1), 0u);
+    EXPECT_EQ(list.rank(10000), sorted.size());
+    for (int lo = 0; lo < 10000; lo += 1234) {
+        for (int hi = lo; hi < 10000; hi += 2345) {
+            size_t expected = std::distance(keys.lower_bound(lo), keys.lower_bound(hi));
+            EXPECT_EQ(list.count_range(lo, hi), expected);
+        }
+    }
+    EXPECT_EQ(list.count_range(5000, 10), 0u);
+}
+
+// readers rank and select while writers change the odd keys,
+// the even keys stay, which bounds every answer
+TYPED_TEST(AllReclaimersTest, ConcurrentRankTest) {
+    Skiplist<int, int, TypeParam, IndexAugmentation> list(nullptr);
+    const int count = 2000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, k);
+    }
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 2; t++) {
+        writers.emplace_back([&list, &stop, t]() {
+            for (int i = t; !stop.load(); i++) {
+                list.insert((i * 7 % count) | 1, 0);
+                list.erase(((i * 13) % count) | 1);
+            }
+        });
+    }
+    for (int round = 0; round < 2000; round++) {
+        int k = (round * 31 % count) & ~1;
+        size_t r = list.rank(k);
+        EXPECT_GE(r, (size_t)k / 2);
+        EXPECT_LE(r, (size_t)k);
+        int found, value;
+        if (list.select(k / 2, found, value)) {
+            // at least k / 2 even keys are below k
+            EXPECT_LE(found, k);
+        }
+    }
+    stop.store(true);
+    for (auto& w : writers) {
+        w.join();
+    }
+    // exact again once the writers are done
+    std::vector<int> keys;
+    list.scan(0, count, count, [&keys](const int& k, const int&) { keys.push_back(k); });
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(list.rank(keys[i]), i);
+    }
+}
+
+// several readers rank, select and count ranges while writers keep
+// changing the odd keys until every reader is done, readers that keep
+// failing validation fall back to the write lock and still finish
+TYPED_TEST(AllReclaimersTest, SummaryReadProgressTest) {
+    Skiplist<int, int, TypeParam, IndexAugmentation> list(nullptr);
+    const int count = 2000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, k);
+    }
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 2; t++) {
+        writers.emplace_back([&list, &stop, t]() {
+            for (int i = t; !stop.load(); i++) {
+                list.insert((i * 7 % count) | 1, 0);
+                list.erase(((i * 13) % count) | 1);
+            }
+        });
+    }
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++) {
+        readers.emplace_back([&list, count, t]() {
+            for (int round = 0; round < 1000; round++) {
+                int lo = (round * 31 + t * 101) % count;
+                int hi = std::min(lo + round % 300, count);
+                // the even keys of [lo, hi) are always there
+                size_t n = list.count_range(lo, hi);
+                EXPECT_GE(n, (size_t)((hi + 1) / 2 - (lo + 1) / 2));
+                EXPECT_LE(n, (size_t)(hi - lo));
+                size_t r = list.rank(lo & ~1);
+                EXPECT_GE(r, (size_t)(lo / 2));
+                EXPECT_LE(r, (size_t)(lo & ~1));
+                int found, value;
+                EXPECT_TRUE(list.select(lo / 2, found, value));
+                EXPECT_LE(found, lo & ~1);
+            }
+        });
+    }
+    for (auto& r : readers) {
+        r.join();
+    }
+    stop.store(true);
+    for (auto& w : writers) {
+        w.join();
+    }
+}
+
+// compare aggregate against a fold over a std::map after random writes
+template<class Monoid>
+void aggregate_test() {
+    Skiplist<int, long, NoReclamation, AggregateAugmentation<Monoid>> list(nullptr);
+    std::map<int, long> pairs;
+    unsigned int seed = 11;
+    for (int i = 0; i < 20000; i++) {
+        int k = rand_r(&seed) % 5000;
+        if (rand_r(&seed) % 4 == 0) {
+            list.erase(k);
+            pairs.erase(k);
+        } else {
+            // updates of existing keys change the summaries too
+            long v = rand_r(&seed) % 100000 - 50000;
+            list.insert(k, v);
+            pairs[k] = v;
+        }
+    }
+    for (int lo = -10; lo < 5000; lo += 397) {
+        for (int hi = lo; hi < 5100; hi += 911) {
+            long expected = Monoid::identity();
+            for (auto it = pairs.lower_bound(lo); (it != pairs.end()) && (it->first <= hi); ++it) {
+                expected = Monoid::combine(expected, it->second);
+            }
+            EXPECT_EQ(list.aggregate(lo, hi), expected);
+        }
+    }
+    EXPECT_EQ(list.aggregate(10, 5), Monoid::identity());
+}
+
+TEST(SkiplistTest, AggregateTest) {
+    aggregate_test<SumMonoid<long>>();
+    aggregate_test<MinMonoid<long>>();
+    aggregate_test<MaxMonoid<long>>();
+}
+
+// sums from several threads while writers insert and erase the odd keys
+// with value 0 and an updater switches the values of the even keys
+// between 1 and 3, so a sum over n even keys lies in [n, 3n] and has
+// the parity of n
+TYPED_TEST(AllReclaimersTest, ConcurrentAggregateTest) {
+    Skiplist<int, long, TypeParam, AggregateAugmentation<SumMonoid<long>>> list(nullptr);
+    const int count = 2000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, 1);
+    }
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 2; t++) {
+        writers.emplace_back([&list, &stop, t]() {
+            for (int i = t; !stop.load(); i++) {
+                list.insert((i * 7 % count) | 1, 0);
+                list.erase(((i * 13) % count) | 1);
+            }
+        });
+    }
+    writers.emplace_back([&list, &stop]() {
+        for (int i = 0; !stop.load(); i++) {
+            list.insert((i * 17 % count) & ~1, (i & 1) ? 3 : 1);
+        }
+    });
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++) {
+        readers.emplace_back([&list, count, t]() {
+            for (int round = 0; round < 1000; round++) {
+                int lo = (round * 31 + t * 101) % count;
+                int hi = std::min(lo + round % 500, count - 1);
+                long n = (hi / 2 + 1) - (lo + 1) / 2;
+                long sum = list.aggregate(lo, hi);
+                EXPECT_GE(sum, n);
+                EXPECT_LE(sum, 3 * n);
+                EXPECT_EQ((sum - n) % 2, 0);
+            }
+        });
+    }
+    for (auto& r : readers) {
+        r.join();
+    }
+    stop.store(true);
+    for (auto& w : writers) {
+        w.join();
+    }
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, 1);
+    }
+    EXPECT_EQ(list.aggregate(0, count), count / 2);
+}
+
+TEST(SkiplistTest, CompareTest) {
+    Skiplist<int, int, NoReclamation, NoAugmentation, std::greater<int>> list(nullptr);
+    for (int k = 0; k < 100; k++) {
+        list.insert(k, k);
+    }
+    Skiplist<int, int, NoReclamation, NoAugmentation, std::greater<int>>::Iterator it(&list);
+    int expected = 99;
+    for (it.seek_to_first(); it.valid(); it.next()) {
+        EXPECT_EQ(it.key(), expected--);
+    }
+    EXPECT_EQ(expected, -1);
+    it.seek(50);
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), 50);
+    EXPECT_TRUE(list.erase(50));
+    it.seek(50);
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), 49);
+    int value;
+    EXPECT_FALSE(list.read(50, value));
+    EXPECT_TRUE(list.read(51, value));
+}
+
+TEST(SkiplistTest, TransparentLookupTest) {
+    Skiplist<std::string, int> list(nullptr);
+    // longer than the small string buffer, so a temporary key would allocate
+    const std::string prefix = "https://example.com/some/long/path/";
+    for (int k = 0; k < 1000; k++) {
+        list.insert(prefix + std::to_string(k), k);
+    }
+    std::string probe = prefix + "500";
+    std::string_view view(probe);
+    const char* cstr = probe.c_str();
+    std::string seek_probe = prefix + "50";
+
+    long before = allocations.load();
+    int value = 0;
+    EXPECT_TRUE(list.read(view, value));
+    EXPECT_EQ(value, 500);
+    EXPECT_TRUE(list.read(cstr, value));
+    EXPECT_EQ(value, 500);
+    EXPECT_FALSE(list.read(std::string_view("https://example.com/missing"), value));
+    Skiplist<std::string, int>::Iterator it(&list);
+    it.seek(std::string_view(seek_probe));
+    EXPECT_EQ(allocations.load() - before, 0);
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), prefix + "50");
+
+    before = allocations.load();
+    EXPECT_TRUE(list.erase(view));
+    EXPECT_FALSE(list.erase(cstr));
+    EXPECT_EQ(allocations.load() - before, 0);
+    EXPECT_FALSE(list.read(probe, value));
+}
+
+// random strings over a small alphabet with '\0' and bytes above 0x7f,
+// of lengths around the 8 bytes of the prefix, so many prefixes tie
+static std::string random_prefix_key(std::mt19937& gen) {
+    static const char alphabet[] = {'\0', 'a', 'b', '\x7f', '\x80', '\xff'};
+    std::string key(gen() % 12, 'a');
+    for (char& c : key) {
+        c = alphabet[gen() % sizeof(alphabet)];
+    }
+    return key;
+}
+
+TEST(KeyPrefixTest, OrderTest) {
+    typedef KeyPrefix<std::string, std::less<>> Prefix;
+    EXPECT_TRUE(Prefix::kEnabled);
+    EXPECT_FALSE((KeyPrefix<int, std::less<>>::kEnabled));
+    EXPECT_FALSE((KeyPrefix<std::string, std::greater<>>::kEnabled));
+    EXPECT_EQ(Prefix::of(std::string("")), 0u);
+    EXPECT_EQ(Prefix::of(std::string("ab")), 0x6162000000000000ull);
+    EXPECT_EQ(Prefix::of(std::string("abcdefghij")), 0x6162636465666768ull);
+
+    std::mt19937 gen(14);
+    for (int i = 0; i < 100000; i++) {
+        std::string a = random_prefix_key(gen);
+        std::string b = random_prefix_key(gen);
+        if (Prefix::of(a) < Prefix::of(b)) {
+            EXPECT_LT(a, b);
+        }
+        if (a == b) {
+            EXPECT_EQ(Prefix::of(a), Prefix::of(b));
+        }
+    }
+}
+
+TEST(SkiplistTest, PrefixTieTest) {
+    Skiplist<std::string, int> list(nullptr);
+    std::map<std::string, int> expected;
+    std::mt19937 gen(14);
+    for (int i = 0; i < 5000; i++) {
+        std::string key = random_prefix_key(gen);
+        if (gen() % 4 == 0) {
+            EXPECT_EQ(list.erase(key), expected.erase(key) == 1);
+        } else {
+            list.insert(key, i);
+            expected[key] = i;
+        }
+    }
+
+    Skiplist<std::string, int>::Iterator it(&list);
+    it.seek_to_first();
+    for (auto& kv : expected) {
+        ASSERT_TRUE(it.valid());
+        EXPECT_EQ(it.key(), kv.first);
+        EXPECT_EQ(it.value(), kv.second);
+        it.next();
+    }
+    EXPECT_FALSE(it.valid());
+
+    for (int i = 0; i < 1000; i++) {
+        std::string key = random_prefix_key(gen);
+        int value = -1;
+        auto found = expected.find(key);
+        EXPECT_EQ(list.read(std::string_view(key), value), found != expected.end());
+        if (found != expected.end()) {
+            EXPECT_EQ(value, found->second);
+        }
+        std::string ge;
+        auto lb = expected.lower_bound(key);
+        EXPECT_EQ(list.lower_bound(key, ge, value), lb != expected.end());
+        if (lb != expected.end()) {
+            EXPECT_EQ(ge, lb->first);
+        }
+    }
+}
+
+TEST(SkiplistTest, NoReclamationTest) {
+    {
+        Skiplist<int, CountedValue> list(nullptr);
+        for (int k = 0; k < 1000; k++) {
+            list.insert(k, CountedValue(k));
+            list.erase(k);
+        }
+        // erased nodes are only freed with the skiplist
+        EXPECT_GE(CountedValue::alive.load(), 1000);
+    }
+    EXPECT_EQ(CountedValue::alive.load(), 0);
+}
+
+// insert and erase through a hot key range, memory must follow the live keys
+template<class Reclaimer>
+void reclamation_test() {
+    {
+        Skiplist<int, CountedValue, Reclaimer> list(nullptr);
+        for (int k = 0; k < 100000; k++) {
+            list.insert(k % 100, CountedValue(k));
+            if (k % 3 == 0) {
+                list.erase(k % 100);
+            }
+        }
+        EXPECT_LT(CountedValue::alive.load(), 1000);
+        CountedValue value;
+        EXPECT_TRUE(list.read(99998 % 100, value));
+        EXPECT_EQ(value.v, 99998);
+    }
+    EXPECT_EQ(CountedValue::alive.load(), 0);
+}
+
+// the same with concurrent writers and a reader
+template<class Reclaimer>
+void concurrent_reclamation_test() {
+    {
+        Skiplist<int, CountedValue, Reclaimer> list(nullptr);
+        const int thread_num = 4;
+        std::atomic<bool> stop(false);
+        std::thread reader([&list, &stop]() {
+            while (!stop.load()) {
+                for (int k = 0; k < 200; k++) {
+                    CountedValue value;
+                    if (list.read(k, value)) {
+                        EXPECT_EQ(value.v % 200, k);
+                    }
+                }
+            }
+        });
+        std::vector<std::thread> writers;
+        for (int t = 0; t < thread_num; t++) {
+            writers.emplace_back([&list, t]() {
+                for (int i = 0; i < 20000; i++) {
+                    int k = (i * thread_num + t) % 200;
+                    list.insert(k, CountedValue(i * thread_num + t));
+                    if (i % 3 == 0) {
+                        list.erase(k);
+                    }
+                }
+            });
+        }
+        for (auto& w : writers) {
+            w.join();
+        }
+        stop.store(true);
+        reader.join();
+        // how much garbage there is while the writers run depends on
+        // the scheduling, a thread preempted in an operation holds back
+        // the epoch based frees, but once they are all gone, the garbage
+        // they left is freed by later operations
+        for (int i = 0; i < 1000; i++) {
+            list.insert(i % 200, CountedValue(i));
+            list.erase(i % 200);
+        }
+        EXPECT_LT(CountedValue::alive.load(), 1000);
+    }
+    EXPECT_EQ(CountedValue::alive.load(), 0);
+}
+
+TEST(SkiplistTest, EpochReclamationTest) {
+    reclamation_test<EpochReclamation>();
+}
+
+TEST(SkiplistTest, EpochReclamationConcurrentTest) {
+    concurrent_reclamation_test<EpochReclamation>();
+}
+
+TEST(SkiplistTest, HazardPointerReclamationTest) {
+    reclamation_test<HazardPointerReclamation>();
+}
+
+TEST(SkiplistTest, HazardPointerReclamationConcurrentTest) {
+    concurrent_reclamation_test<HazardPointerReclamation>();
+}
+
+struct CountedObject : public Reclaimable {
+    static int alive;
+    CountedObject() {
+        alive++;
+        reclaim = [](Reclaimable* r) { delete static_cast<CountedObject*>(r); };
+    }
+    ~CountedObject() { alive--; }
+};
+int CountedObject::alive = 0;
+
+TEST(ReclaimerTest, StalledGuardTest) {
+    // a guard that never leaves blocks every epoch based free,
+    // once it is gone the next guards that exit free everything
+    {
+        EpochReclamation domain;
+        std::unique_ptr<EpochReclamation::Guard> stalled(new EpochReclamation::Guard(domain));
+        for (int i = 0; i < 10000; i++) {
+            EpochReclamation::Guard guard(domain);
+            guard.retire(new CountedObject());
+        }
+        EXPECT_EQ(CountedObject::alive, 10000);
+        stalled.reset();
+        for (int i = 0; i < 3; i++) {
+            EpochReclamation::Guard guard(domain);
+            guard.retire(new CountedObject());
+        }
+        EXPECT_LE(CountedObject::alive, 3);
+    }
+    EXPECT_EQ(CountedObject::alive, 0);
+
+    // but it only keeps what its hazard pointers hold
+    {
+        HazardPointerReclamation domain(2);
+        std::atomic<CountedObject*> shared(new CountedObject());
+        HazardPointerReclamation::Guard stalled(domain);
+        CountedObject* held = stalled.protect(0, shared);
+        for (int i = 0; i < 10000; i++) {
+            HazardPointerReclamation::Guard guard(domain);
+            CountedObject* old = shared.exchange(new CountedObject());
+            guard.retire(old);
+        }
+        EXPECT_LT(CountedObject::alive, 1000);
+        EXPECT_EQ(held->alive, CountedObject::alive);
+        HazardPointerReclamation::Guard guard(domain);
+        guard.retire(shared.load());
+    }
+    EXPECT_EQ(CountedObject::alive, 0);
+}
+
+TEST(ReclaimerTest, RetireThresholdTest) {
+    // with a threshold of 1 every retire collects, so only the last few
+    // objects are kept
+    {
+        EpochReclamation domain(0, 1);
+        for (int i = 0; i < 10000; i++) {
+            EpochReclamation::Guard guard(domain);
+            guard.retire(new CountedObject());
+            EXPECT_LE(CountedObject::alive, 3);
+        }
+    }
+    EXPECT_EQ(CountedObject::alive, 0);
+    // the default collects a batch of them at a time within a guard,
+    // but a guard exiting frees what expired as well
+    {
+        EpochReclamation domain;
+        for (int i = 0; i < 100; i++) {
+            EpochReclamation::Guard guard(domain);
+            guard.retire(new CountedObject());
+        }
+        EXPECT_LE(CountedObject::alive, 3);
+    }
+    EXPECT_EQ(CountedObject::alive, 0);
+}
+
+TEST(ArenaTest, AlignmentTest) {
+    Arena arena;
+    for (int i = 1; i < 1000; i++) {
+        size_t align = size_t(1) << (i % 7);
+        char* p = (char*)arena.allocate(i % 100 + 1, align);
+        EXPECT_EQ((uintptr_t)p % align, 0u);
+    }
+    // large allocations get their own block
+    char* big = (char*)arena.allocate(1 << 20, 8);
+    big[0] = big[(1 << 20) - 1] = 1;
+    EXPECT_GE(arena.memory_usage(), size_t(1 << 20));
+}
+
+TEST(ArenaTest, HotBytesTest) {
+    Arena arena;
+    for (int i = 0; i < 1000; i++) {
+        size_t hot = 8 + (i % 7) * 8;
+        uintptr_t p = (uintptr_t)arena.allocate(hot + i % 200, 8, hot);
+        // the hot prefix never straddles a cache line
+        EXPECT_EQ(p / CACHE_LINE_SIZE, (p + hot - 1) / CACHE_LINE_SIZE);
+    }
+}
+
+TEST(ArenaTest, ConcurrentAllocateTest) {
+    Arena arena;
+    const int thread_num = 4;
+    const int count = 20000;
+    std::vector<std::vector<int*>> ptrs(thread_num);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_num; t++) {
+        threads.emplace_back([&arena, &ptrs, t]() {
+            for (int i = 0; i < count; i++) {
+                int* p = (int*)arena.allocate(sizeof(int) * 4, alignof(int));
+                p[0] = p[3] = t * count + i;
+                ptrs[t].push_back(p);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    // no allocation was handed out twice
+    for (int t = 0; t < thread_num; t++) {
+        for (int i = 0; i < count; i++) {
+            EXPECT_EQ(ptrs[t][i][0], t * count + i);
+            EXPECT_EQ(ptrs[t][i][3], t * count + i);
+        }
+    }
+}
+
+// random inserts and erases against std::map, small blocks split and merge often
+template<class Key, int BlockSize>
+void fat_skiplist_random_test() {
+    FatSkiplist<Key, int, BlockSize> list;
+    std::map<Key, int> expected;
+    std::mt19937 gen(17);
+    const int range = 5000;
+    for (int i = 0; i < 50000; i++) {
+        Key key = Key(gen() % range) - Key(std::is_signed<Key>::value ? range / 2 : 0);
+        if (gen() % 3 == 0) {
+            EXPECT_EQ(list.erase(key), expected.erase(key) == 1);
+        } else {
+            list.insert(key, i);
+            expected[key] = i;
+        }
+    }
+    EXPECT_EQ(list.size(), expected.size());
+    for (int k = 0; k < range; k++) {
+        Key key = Key(k) - Key(std::is_signed<Key>::value ? range / 2 : 0);
+        int value = -1;
+        auto it = expected.find(key);
+        ASSERT_EQ(list.read(key, value), it != expected.end());
+        if (it != expected.end()) {
+            EXPECT_EQ(value, it->second);
+        }
+    }
+    // nodes stay at least a quarter full unless both neighbours are too full to merge
+    EXPECT_LE(list.node_count(), 4 * expected.size() / BlockSize + 2);
+
+    for (auto& kv : expected) {
+        EXPECT_TRUE(list.erase(kv.first));
+    }
+    EXPECT_EQ(list.size(), 0u);
+    EXPECT_EQ(list.node_count(), 1u);
+}
+
+TEST(FatSkiplistTest, RandomTest) {
+    fat_skiplist_random_test<int, 16>();
+    fat_skiplist_random_test<int, 4>();
+    fat_skiplist_random_test<int64_t, 16>();
+    fat_skiplist_random_test<int64_t, 8>();
+    // no SIMD path for them
+    fat_skiplist_random_test<uint32_t, 16>();
+    fat_skiplist_random_test<int16_t, 8>();
+}
+
+TEST(FatSkiplistTest, ExtremeKeyTest) {
+    FatSkiplist<int, int> list;
+    // the max of Key pads the unused lanes of a block
+    list.insert(INT_MAX, 1);
+    list.insert(INT_MIN, 2);
+    list.insert(0, 3);
+    int value;
+    EXPECT_TRUE(list.read(INT_MAX, value));
+    EXPECT_EQ(value, 1);
+    EXPECT_TRUE(list.read(INT_MIN, value));
+    EXPECT_EQ(value, 2);
+    EXPECT_FALSE(list.read(INT_MAX - 1, value));
+    EXPECT_TRUE(list.erase(INT_MAX));
+    EXPECT_FALSE(list.read(INT_MAX, value));
+}
+
+TEST(FatSkiplistTest, ConcurrentTest) {
+    FatSkiplist<int, int, 8> list;
+    const int count = 4000;
+    for (int k = 0; k < count; k += 2) {
+        list.insert(k, k);
+    }
+    std::atomic<bool> stop(false);
+    // two writers, they take turns
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 2; t++) {
+        writers.emplace_back([&list, &stop, t]() {
+            for (int i = t; !stop.load(); i++) {
+                // the odd keys come and go, whole runs of them at once,
+                // so nodes split and merge under the readers
+                int base = (i * 97 % (count / 64)) * 64;
+                for (int k = base | 1; k < base + 64; k += 2) {
+                    list.insert(k, k);
+                }
+                for (int k = base | 1; k < base + 64; k += 2) {
+                    list.erase(k);
+                }
+            }
+        });
+    }
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++) {
+        readers.emplace_back([&list]() {
+            for (int round = 0; round < 30; round++) {
+                for (int k = 0; k < count; k++) {
+                    int value = -1;
+                    bool found = list.read(k, value);
+                    // the even keys are never erased
+                    if (k % 2 == 0) {
+                        EXPECT_TRUE(found);
+                    }
+                    if (found) {
+                        EXPECT_EQ(value, k);
+                    }
+                }
+            }
+        });
+    }
+    for (auto& th : readers) {
+        th.join();
+    }
+    stop.store(true);
+    for (auto& th : writers) {
+        th.join();
+    }
+    EXPECT_EQ(list.size(), (size_t)count / 2);
+}
+
 int main() {
     testing::InitGoogleTest();
     return RUN_ALL_TESTS();